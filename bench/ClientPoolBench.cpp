@@ -0,0 +1,72 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MqttClientPool.hpp"
+
+// Publishes the same burst through an MqttClientPool of 1, 2, 4 and 8 connections to a
+// local broker and reports the throughput until every message was acknowledged. One
+// producer thread per connection, each owning a subset of the topics.
+// Usage: bench-client-pool [host] [port] [messages] [payload bytes] [qos >= 1]
+
+int main(int argc, char *argv[]){
+    std::string host = argc > 1 ? argv[1] : "localhost";
+    int port = argc > 2 ? std::atoi(argv[2]) : 1883;
+    size_t count = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 200000;
+    size_t payloadSize = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 64;
+    int qos = argc > 5 ? std::atoi(argv[5]) : 1;
+    const size_t topics = 256;
+
+    std::string payload(payloadSize, 'x');
+    std::vector<std::string> topicNames;
+    for(size_t i = 0; i < topics; ++i){
+        topicNames.push_back("bench/pool/" + std::to_string(i));
+    }
+
+    for(size_t connections : {1, 2, 4, 8}){
+        MqttClientPool pool(host, port, "bench-client-pool-" + std::to_string(connections), connections);
+        std::mutex mutex;
+        std::condition_variable completed;
+        std::atomic<size_t> acknowledged{0};
+        pool.onPublishResult([&](MqttCallbacks::PublishResult result, int messageId, mqtt::const_message_ptr msg){
+            if(acknowledged.fetch_add(1) + 1 == count){
+                std::lock_guard<std::mutex> lock(mutex);
+                completed.notify_all();
+            }
+        });
+        pool.start();
+        while(!pool.isConnected()){
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> producers;
+        for(size_t producer = 0; producer < connections; ++producer){
+            producers.emplace_back([&, producer] {
+                for(size_t i = producer; i < count; i += connections){
+                    pool.publish(topicNames[i % topics], payload, qos, false);
+                }
+            });
+        }
+        for(auto& producer : producers){
+            producer.join();
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            completed.wait(lock, [&] { return acknowledged.load() >= count; });
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        double seconds = std::chrono::duration<double>(end - start).count();
+        std::cout << "connections=" << connections << " messages=" << count << " payload=" << payloadSize
+            << " qos=" << qos << " msgs_per_s=" << count / seconds << std::endl;
+        pool.finish();
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,247 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LatencyHistogram.hpp"
+#include "LoopbackBroker.hpp"
+#include "MqttClient.hpp"
+#include "MqttMetrics.hpp"
+
+// Load test of the publish and dispatch paths: one MqttClient publishes to another through
+// a broker, sweeping every combination of payload size, QoS, handler filter count, worker
+// count and handler cost. Each payload carries its send time, so the subscriber's handlers
+// record end-to-end latency. With --churn 1 another thread keeps adding and removing (and
+// unsubscribing) handlers of wildcard filters over the measured topics meanwhile, so dispatch
+// runs against handler table swaps; QoS 1 and 2 runs then fail unless every measured handler
+// saw exactly its messages. Results go to stdout as one JSON document for CI to compare
+// between commits, progress goes to stderr. Exits with EXIT_FAILURE if a run failed.
+// Usage: bench [--broker host:port] [--mqtt-version 4|5] [--messages n] [--sizes 64,1024]
+//              [--qos 0,1] [--filters 1,1000] [--workers 1,4] [--handler-us 0,50] [--churn 0|1]
+// Without --broker an in-process LoopbackBroker is used.
+
+struct benchConfig {
+    std::string host = "127.0.0.1";
+    int port = 0;
+    int mqttVersion = MQTTVERSION_3_1_1;
+    size_t messages = 100000;
+    std::vector<size_t> sizes{64, 1024};
+    std::vector<size_t> qos{0, 1};
+    std::vector<size_t> filters{1, 1000};
+    std::vector<size_t> workers{1, 4};
+    std::vector<size_t> handlerMicros{0};
+    bool churn = false;
+};
+
+struct runResult {
+    uint64_t handled = 0;
+    double submitSeconds = 0;
+    double seconds = 0;
+    LatencyHistogram::summary latency;
+    // handlers added and removed while messages flowed
+    uint64_t churnOperations = 0;
+};
+
+static std::vector<size_t> parseList(const std::string& value){
+    std::vector<size_t> list;
+    std::stringstream stream(value);
+    std::string item;
+    while(std::getline(stream, item, ',')){
+        list.push_back(std::strtoul(item.c_str(), nullptr, 10));
+    }
+    return list;
+}
+
+static benchConfig parseArguments(int argc, char *argv[]){
+    benchConfig config;
+    for(int i = 1; i + 1 < argc; i += 2){
+        std::string key = argv[i];
+        std::string value = argv[i + 1];
+        if(key == "--broker"){
+            size_t colon = value.rfind(':');
+            config.host = value.substr(0, colon);
+            config.port = colon == std::string::npos ? 1883 : std::atoi(value.c_str() + colon + 1);
+        } else if(key == "--mqtt-version"){
+            config.mqttVersion = std::atoi(value.c_str());
+        } else if(key == "--messages"){
+            config.messages = std::strtoul(value.c_str(), nullptr, 10);
+        } else if(key == "--sizes"){
+            config.sizes = parseList(value);
+        } else if(key == "--qos"){
+            config.qos = parseList(value);
+        } else if(key == "--filters"){
+            config.filters = parseList(value);
+        } else if(key == "--workers"){
+            config.workers = parseList(value);
+        } else if(key == "--handler-us"){
+            config.handlerMicros = parseList(value);
+        } else if(key == "--churn"){
+            config.churn = std::atoi(value.c_str()) != 0;
+        } else {
+            std::cerr << "unknown option " << key << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    return config;
+}
+
+static void waitConnected(MqttClient& client){
+    while(!client.isConnected()){
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+}
+
+static runResult run(const benchConfig& config, int runIndex, size_t payloadSize, int qos, size_t filterCount, int numWorkers, size_t handlerMicros){
+    std::string prefix = "bench/" + std::to_string(runIndex) + "/";
+    MqttClient subscriber(config.host, config.port, "bench-sub-" + std::to_string(runIndex), config.mqttVersion, "");
+    MqttClient publisher(config.host, config.port, "bench-pub-" + std::to_string(runIndex), config.mqttVersion, "");
+    MqttCallbacks::dispatchSettings dispatch;
+    dispatch.numWorkers = numWorkers;
+    subscriber.dispatch(dispatch);
+
+    auto latency = std::make_unique<LatencyHistogram>();
+    std::atomic<uint64_t> handled{0};
+    std::atomic<int64_t> lastHandledAt{0};
+    int64_t handlerNanos = static_cast<int64_t>(handlerMicros) * 1000;
+    auto handler = [&](std::string_view topic, std::string_view payload, std::string& response){
+        int64_t sentAt;
+        std::memcpy(&sentAt, payload.data(), sizeof(sentAt));
+        if(handlerNanos > 0){
+            int64_t until = MqttMetrics::now() + handlerNanos;
+            while(MqttMetrics::now() < until){
+            }
+        }
+        int64_t now = MqttMetrics::now();
+        latency->record(static_cast<uint64_t>(now - sentAt));
+        lastHandledAt.store(now, std::memory_order_relaxed);
+        handled.fetch_add(1, std::memory_order_relaxed);
+    };
+    std::vector<std::string> topics;
+    for(size_t i = 0; i < filterCount; ++i){
+        topics.push_back(prefix + std::to_string(i));
+        subscriber.on(topics.back(), MqttCallbacks::messageViewHandler(handler), qos);
+    }
+    // subscribed last, so once a probe comes back every handler filter is in place
+    std::atomic<bool> ready{false};
+    subscriber.on(prefix + "ready", [&](std::string_view topic, std::string_view payload, std::string& response){
+        ready = true;
+    });
+
+    subscriber.start();
+    publisher.start();
+    waitConnected(subscriber);
+    waitConnected(publisher);
+    while(!ready){
+        publisher.publish(prefix + "ready", "", 0, false);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+
+    std::atomic<bool> stopChurn{false};
+    std::atomic<uint64_t> churnOperations{0};
+    std::thread churner;
+    if(config.churn){
+        churner = std::thread([&] {
+            auto ignore = [](std::string_view topic, std::string_view payload, std::string& response){
+            };
+            // both match every measured topic, and each is removed both ways in turn
+            const std::string churnFilters[] = {prefix + "+", prefix + "#"};
+            for(size_t i = 0; !stopChurn; ++i){
+                const std::string& churnFilter = churnFilters[(i / 2) % 2];
+                subscriber.on(churnFilter, MqttCallbacks::messageViewHandler(ignore), qos);
+                if(i % 2 == 0){
+                    subscriber.off(churnFilter);
+                } else {
+                    subscriber.unsubscribe(churnFilter);
+                }
+                churnOperations.fetch_add(2, std::memory_order_relaxed);
+            }
+        });
+    }
+
+    std::string payload(std::max<size_t>(payloadSize, sizeof(int64_t)), 'x');
+    int64_t startedAt = MqttMetrics::now();
+    for(size_t i = 0; i < config.messages; ++i){
+        int64_t now = MqttMetrics::now();
+        std::memcpy(&payload[0], &now, sizeof(now));
+        publisher.publish(topics[i % filterCount], payload, qos, false);
+    }
+    int64_t submittedAt = MqttMetrics::now();
+
+    // done when everything arrived, or when nothing more arrived for a while (QoS 0 losses)
+    uint64_t seen = 0;
+    auto lastProgress = std::chrono::steady_clock::now();
+    while(handled.load() < config.messages && std::chrono::steady_clock::now() - lastProgress < std::chrono::seconds(5)){
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if(handled.load() != seen){
+            seen = handled.load();
+            lastProgress = std::chrono::steady_clock::now();
+        }
+    }
+    stopChurn = true;
+    if(churner.joinable()){
+        churner.join();
+    }
+    publisher.finish();
+    subscriber.finish();
+
+    runResult result;
+    result.handled = handled.load();
+    result.submitSeconds = (submittedAt - startedAt) / 1e9;
+    result.seconds = (std::max(lastHandledAt.load(), startedAt + 1) - startedAt) / 1e9;
+    result.latency = latency->summarize();
+    result.churnOperations = churnOperations.load();
+    return result;
+}
+
+int main(int argc, char *argv[]){
+    benchConfig config = parseArguments(argc, argv);
+    std::unique_ptr<LoopbackBroker> broker;
+    if(config.port == 0){
+        broker = std::make_unique<LoopbackBroker>();
+        config.port = broker->port();
+    }
+
+    std::ostringstream out;
+    out << "{\"broker\":\"" << (broker ? "loopback" : config.host + ":" + std::to_string(config.port))
+        << "\",\"mqtt_version\":" << config.mqttVersion << ",\"messages\":" << config.messages
+        << ",\"churn\":" << (config.churn ? "true" : "false") << ",\"results\":[";
+    int runIndex = 0;
+    bool failed = false;
+    for(size_t payloadSize : config.sizes){
+        for(size_t qos : config.qos){
+            for(size_t filterCount : config.filters){
+                for(size_t numWorkers : config.workers){
+                    for(size_t handlerMicros : config.handlerMicros){
+                        std::cerr << "payload=" << payloadSize << " qos=" << qos << " filters=" << filterCount
+                            << " workers=" << numWorkers << " handler_us=" << handlerMicros << std::flush;
+                        runResult result = run(config, runIndex, payloadSize, static_cast<int>(qos), filterCount, static_cast<int>(numWorkers), handlerMicros);
+                        double rate = result.handled / result.seconds;
+                        std::cerr << " msgs_per_s=" << rate << " p99_us=" << result.latency.p99 / 1e3 << std::endl;
+                        // nothing may be lost or delivered twice to the measured handlers while the table churns
+                        if(config.churn && qos > 0 && result.handled != config.messages){
+                            std::cerr << "FAILED: handled " << result.handled << " of " << config.messages << " messages under churn" << std::endl;
+                            failed = true;
+                        }
+                        out << (runIndex > 0 ? "," : "") << "{\"payload\":" << payloadSize << ",\"qos\":" << qos
+                            << ",\"filters\":" << filterCount << ",\"workers\":" << numWorkers << ",\"handler_us\":" << handlerMicros
+                            << ",\"handled\":" << result.handled << ",\"submit_msgs_per_s\":" << config.messages / result.submitSeconds
+                            << ",\"msgs_per_s\":" << rate << ",\"churn_ops\":" << result.churnOperations
+                            << ",\"latency_us\":{\"p50\":" << result.latency.p50 / 1e3 << ",\"p90\":" << result.latency.p90 / 1e3
+                            << ",\"p99\":" << result.latency.p99 / 1e3 << ",\"p999\":" << result.latency.p999 / 1e3
+                            << ",\"max\":" << result.latency.max / 1e3 << "}}";
+                        ++runIndex;
+                    }
+                }
+            }
+        }
+    }
+    out << "]}";
+    std::cout << out.str() << std::endl;
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,378 @@
+#include "LoopbackBroker.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// buffered reads of whole packets off one connection
+class packetReader {
+    private:
+        int _fd;
+        std::vector<char> _buffer = std::vector<char>(64 * 1024);
+        size_t _begin = 0;
+        size_t _end = 0;
+
+        bool fill(){
+            if(_begin == _end){
+                _begin = _end = 0;
+            }
+            if(_end == _buffer.size()){
+                std::memmove(_buffer.data(), _buffer.data() + _begin, _end - _begin);
+                _end -= _begin;
+                _begin = 0;
+            }
+            ssize_t got = recv(_fd, _buffer.data() + _end, _buffer.size() - _end, 0);
+            if(got <= 0){
+                return false;
+            }
+            _end += static_cast<size_t>(got);
+            return true;
+        }
+
+        bool readByte(uint8_t& byte){
+            if(_begin == _end && !fill()){
+                return false;
+            }
+            byte = static_cast<uint8_t>(_buffer[_begin++]);
+            return true;
+        }
+
+    public:
+        explicit packetReader(int fd) : _fd(fd) {}
+
+        bool next(uint8_t& header, std::string& body){
+            if(!readByte(header)){
+                return false;
+            }
+            size_t length = 0;
+            for(int shift = 0; shift < 28; shift += 7){
+                uint8_t byte;
+                if(!readByte(byte)){
+                    return false;
+                }
+                length |= static_cast<size_t>(byte & 0x7F) << shift;
+                if(!(byte & 0x80)){
+                    break;
+                }
+            }
+            body.resize(length);
+            size_t copied = 0;
+            while(copied < length){
+                if(_begin == _end && !fill()){
+                    return false;
+                }
+                size_t chunk = std::min(length - copied, _end - _begin);
+                std::memcpy(&body[copied], _buffer.data() + _begin, chunk);
+                _begin += chunk;
+                copied += chunk;
+            }
+            return true;
+        }
+};
+
+static void appendLength(std::string& packet, size_t length){
+    do {
+        uint8_t byte = length % 128;
+        length /= 128;
+        if(length > 0){
+            byte |= 0x80;
+        }
+        packet += static_cast<char>(byte);
+    } while(length > 0);
+}
+
+static void appendU16(std::string& packet, uint16_t value){
+    packet += static_cast<char>(value >> 8);
+    packet += static_cast<char>(value & 0xFF);
+}
+
+static uint16_t readU16(const std::string& body, size_t& at){
+    if(at + 2 > body.size()){
+        throw std::out_of_range("truncated packet");
+    }
+    uint16_t value = static_cast<uint16_t>((static_cast<uint8_t>(body[at]) << 8) | static_cast<uint8_t>(body[at + 1]));
+    at += 2;
+    return value;
+}
+
+static std::string readString(const std::string& body, size_t& at){
+    uint16_t length = readU16(body, at);
+    if(at + length > body.size()){
+        throw std::out_of_range("truncated packet");
+    }
+    std::string value = body.substr(at, length);
+    at += length;
+    return value;
+}
+
+// MQTT 5 properties are skipped, the broker honours none of them
+static void skipProperties(const std::string& body, size_t& at){
+    size_t length = 0;
+    for(int shift = 0; shift < 28; shift += 7){
+        if(at >= body.size()){
+            throw std::out_of_range("truncated packet");
+        }
+        uint8_t byte = static_cast<uint8_t>(body[at++]);
+        length |= static_cast<size_t>(byte & 0x7F) << shift;
+        if(!(byte & 0x80)){
+            break;
+        }
+    }
+    at += length;
+}
+
+static std::string acknowledgement(uint8_t header, uint16_t packetId){
+    std::string packet(1, static_cast<char>(header));
+    packet += static_cast<char>(2);
+    appendU16(packet, packetId);
+    return packet;
+}
+
+// filter of a subscription, a shared one delivered to its subscriber like any other
+static std::string shareFilter(std::string filter){
+    constexpr const char* sharePrefix = "$share/";
+    if(filter.compare(0, 7, sharePrefix) == 0){
+        size_t groupEnd = filter.find('/', 7);
+        filter = groupEnd == std::string::npos ? "" : filter.substr(groupEnd + 1);
+    }
+    return filter;
+}
+
+// the subscriptions of client in the filter index
+template <typename S>
+static auto sameSession(const std::shared_ptr<S>& client){
+    return [&client](const std::weak_ptr<S>& subscribed){
+        return !subscribed.owner_before(client) && !client.owner_before(subscribed);
+    };
+}
+
+LoopbackBroker::LoopbackBroker(int port){
+    _listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if(_listenFd < 0){
+        throw std::runtime_error("LoopbackBroker: cannot create socket");
+    }
+    int reuse = 1;
+    setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    if(bind(_listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(_listenFd, 64) != 0){
+        close(_listenFd);
+        throw std::runtime_error("LoopbackBroker: cannot listen on port " + std::to_string(port));
+    }
+    socklen_t length = sizeof(address);
+    getsockname(_listenFd, reinterpret_cast<sockaddr*>(&address), &length);
+    _port = ntohs(address.sin_port);
+    _acceptThread = std::thread(&LoopbackBroker::acceptLoop, this);
+}
+
+LoopbackBroker::~LoopbackBroker(){
+    _stopping = true;
+    shutdown(_listenFd, SHUT_RDWR);
+    close(_listenFd);
+    _acceptThread.join();
+    std::lock_guard<std::mutex> lock(_sessionsMutex);
+    for(auto& client : _sessions){
+        shutdown(client->fd, SHUT_RDWR);
+        client->reader.join();
+        close(client->fd);
+    }
+}
+
+int LoopbackBroker::port() const {
+    return _port;
+}
+
+uint64_t LoopbackBroker::received() const {
+    return _received.load(std::memory_order_relaxed);
+}
+
+uint64_t LoopbackBroker::delivered() const {
+    return _delivered.load(std::memory_order_relaxed);
+}
+
+void LoopbackBroker::acceptLoop(){
+    while(!_stopping){
+        int fd = accept(_listenFd, nullptr, nullptr);
+        if(fd < 0){
+            continue;
+        }
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        auto client = std::make_shared<session>();
+        client->fd = fd;
+        std::lock_guard<std::mutex> lock(_sessionsMutex);
+        if(_stopping){
+            close(fd);
+            return;
+        }
+        client->reader = std::thread(&LoopbackBroker::sessionLoop, this, client);
+        _sessions.push_back(std::move(client));
+    }
+}
+
+void LoopbackBroker::sessionLoop(std::shared_ptr<session> client){
+    packetReader reader(client->fd);
+    uint8_t header;
+    std::string body;
+    try {
+        while(reader.next(header, body) && handle(client, header, body)){
+        }
+    } catch (const std::out_of_range& exc) {
+        // malformed packet, drop the connection like a broker would
+    }
+    client->alive = false;
+    // the fd stays open until destruction so a concurrent forward never writes to a reused one
+    shutdown(client->fd, SHUT_RDWR);
+}
+
+bool LoopbackBroker::handle(const std::shared_ptr<session>& client, uint8_t header, const std::string& body){
+    size_t at = 0;
+    switch(header >> 4){
+        case 1:{ // CONNECT
+            readString(body, at);
+            client->version = static_cast<uint8_t>(body.at(at));
+            std::string connack = client->version >= 5 ? std::string("\x20\x03\x00\x00\x00", 5) : std::string("\x20\x02\x00\x00", 4);
+            return write(*client, connack);
+        }
+        case 3:{ // PUBLISH
+            int qos = (header >> 1) & 3;
+            std::string topic = readString(body, at);
+            uint16_t packetId = qos > 0 ? readU16(body, at) : 0;
+            if(client->version >= 5){
+                skipProperties(body, at);
+            }
+            _received.fetch_add(1, std::memory_order_relaxed);
+            forward(topic, body.data() + at, body.size() - at);
+            if(qos == 1){
+                return write(*client, acknowledgement(0x40, packetId));
+            }
+            if(qos == 2){
+                return write(*client, acknowledgement(0x50, packetId));
+            }
+            return true;
+        }
+        case 6:{ // PUBREL
+            return write(*client, acknowledgement(0x70, readU16(body, at)));
+        }
+        case 8:{ // SUBSCRIBE
+            uint16_t packetId = readU16(body, at);
+            if(client->version >= 5){
+                skipProperties(body, at);
+            }
+            std::string codes;
+            while(at < body.size()){
+                std::string filter = shareFilter(readString(body, at));
+                ++at; // options, everything is delivered at QoS 0
+                try {
+                    std::unique_lock<std::shared_mutex> lock(_subscriptionsMutex);
+                    // subscribing again to a filter replaces the subscription
+                    _subscriptions.erase(filter, sameSession(client));
+                    _subscriptions.insert(filter, client);
+                    codes += '\0';
+                } catch (const std::invalid_argument& exc) {
+                    codes += '\x80';
+                }
+            }
+            std::string suback(1, '\x90');
+            bool properties = client->version >= 5;
+            appendLength(suback, 2 + (properties ? 1 : 0) + codes.size());
+            appendU16(suback, packetId);
+            if(properties){
+                suback += '\0';
+            }
+            return write(*client, suback + codes);
+        }
+        case 10:{ // UNSUBSCRIBE
+            uint16_t packetId = readU16(body, at);
+            if(client->version >= 5){
+                skipProperties(body, at);
+            }
+            std::string codes;
+            while(at < body.size()){
+                std::string filter = shareFilter(readString(body, at));
+                std::unique_lock<std::shared_mutex> lock(_subscriptionsMutex);
+                // 0x11, no subscription existed
+                codes += _subscriptions.erase(filter, sameSession(client)) > 0 ? '\0' : '\x11';
+            }
+            if(client->version < 5){
+                return write(*client, acknowledgement(0xB0, packetId));
+            }
+            std::string unsuback(1, '\xB0');
+            appendLength(unsuback, 3 + codes.size());
+            appendU16(unsuback, packetId);
+            unsuback += '\0';
+            return write(*client, unsuback + codes);
+        }
+        case 12:{ // PINGREQ
+            return write(*client, std::string("\xD0\x00", 2));
+        }
+        case 14:{ // DISCONNECT
+            return false;
+        }
+        default:
+            // PUBACK, PUBREC, PUBCOMP of QoS 0 deliveries never come, AUTH is not supported
+            return true;
+    }
+}
+
+void LoopbackBroker::forward(const std::string& topic, const char* payload, size_t size){
+    thread_local std::vector<std::weak_ptr<session>> matches;
+    matches.clear();
+    {
+        std::shared_lock<std::shared_mutex> lock(_subscriptionsMutex);
+        _subscriptions.match(topic, matches);
+    }
+    if(matches.empty()){
+        return;
+    }
+    // one copy per session however many of its filters match, like the usual brokers
+    thread_local std::vector<std::shared_ptr<session>> subscribers;
+    subscribers.clear();
+    for(const auto& match : matches){
+        std::shared_ptr<session> subscriber = match.lock();
+        if(subscriber && subscriber->alive && std::find(subscribers.begin(), subscribers.end(), subscriber) == subscribers.end()){
+            subscribers.push_back(std::move(subscriber));
+        }
+    }
+    // built once per protocol version, v5 has an empty property block
+    std::string packets[2];
+    for(const auto& subscriber : subscribers){
+        bool properties = subscriber->version >= 5;
+        std::string& packet = packets[properties ? 1 : 0];
+        if(packet.empty()){
+            packet += '\x30';
+            appendLength(packet, 2 + topic.size() + (properties ? 1 : 0) + size);
+            appendU16(packet, static_cast<uint16_t>(topic.size()));
+            packet += topic;
+            if(properties){
+                packet += '\0';
+            }
+            packet.append(payload, size);
+        }
+        if(write(*subscriber, packet)){
+            _delivered.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+bool LoopbackBroker::write(session& client, const std::string& packet){
+    std::lock_guard<std::mutex> lock(client.writeMutex);
+    size_t sent = 0;
+    while(sent < packet.size()){
+        ssize_t written = send(client.fd, packet.data() + sent, packet.size() - sent, MSG_NOSIGNAL);
+        if(written <= 0){
+            client.alive = false;
+            return false;
+        }
+        sent += static_cast<size_t>(written);
+    }
+    return true;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "TopicTrie.hpp"
+
+// Just enough of an MQTT 3.1.1 / 5 broker on 127.0.0.1 for the bench harness to run
+// without a real one: CONNECT, SUBSCRIBE, UNSUBSCRIBE, PUBLISH at QoS 0/1/2 (acknowledged as
+// a broker would), PINGREQ and DISCONNECT. Messages are forwarded at QoS 0, once to every
+// session with a matching filter, without properties, retained messages, sessions or authentication.
+// One thread per connection; the port is picked by the OS unless given.
+class LoopbackBroker {
+    private:
+        struct session {
+            int fd = -1;
+            int version = 4;
+            std::mutex writeMutex;
+            std::atomic<bool> alive{true};
+            std::thread reader;
+        };
+
+        int _listenFd = -1;
+        int _port = 0;
+        std::atomic<bool> _stopping{false};
+        std::thread _acceptThread;
+
+        std::mutex _sessionsMutex;
+        std::vector<std::shared_ptr<session>> _sessions;
+
+        // filter index over the sessions that subscribed, one value per session and filter.
+        // Dead sessions are skipped on delivery
+        std::shared_mutex _subscriptionsMutex;
+        TopicTrie<std::weak_ptr<session>> _subscriptions;
+
+        std::atomic<uint64_t> _received{0};
+        std::atomic<uint64_t> _delivered{0};
+
+        void acceptLoop();
+        void sessionLoop(std::shared_ptr<session> client);
+        // handles one packet, false to close the connection
+        bool handle(const std::shared_ptr<session>& client, uint8_t header, const std::string& body);
+        void forward(const std::string& topic, const char* payload, size_t size);
+        static bool write(session& client, const std::string& packet);
+
+    public:
+        explicit LoopbackBroker(int port = 0);
+        ~LoopbackBroker();
+
+        LoopbackBroker(const LoopbackBroker&) = delete;
+        LoopbackBroker& operator=(const LoopbackBroker&) = delete;
+
+        int port() const;
+        // PUBLISH packets received from clients
+        uint64_t received() const;
+        // PUBLISH packets written to subscribers
+        uint64_t delivered() const;
+};
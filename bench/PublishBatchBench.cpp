@@ -0,0 +1,70 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MqttClient.hpp"
+
+// Publishes the same burst of messages to a local broker as a loop of single publishes
+// and as one publishBatch, and reports the time until every message was acknowledged.
+// Usage: bench-publish-batch [host] [port] [messages] [payload bytes] [qos >= 1]
+
+int main(int argc, char *argv[]){
+    std::string host = argc > 1 ? argv[1] : "localhost";
+    int port = argc > 2 ? std::atoi(argv[2]) : 1883;
+    size_t count = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 50000;
+    size_t payloadSize = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 64;
+    int qos = argc > 5 ? std::atoi(argv[5]) : 1;
+
+    MqttClient mqttClient(host, port, "bench-publish-batch");
+    std::mutex mutex;
+    std::condition_variable completed;
+    std::atomic<size_t> acknowledged{0};
+    mqttClient.onPublishResult([&](MqttCallbacks::PublishResult result, int messageId, mqtt::const_message_ptr msg){
+        if(acknowledged.fetch_add(1) + 1 == count){
+            std::lock_guard<std::mutex> lock(mutex);
+            completed.notify_all();
+        }
+    });
+    mqttClient.start();
+    while(!mqttClient.isConnected()){
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    std::string payload(payloadSize, 'x');
+    std::vector<MqttClient::publishEntry> entries;
+    entries.reserve(count);
+    for(size_t i = 0; i < count; ++i){
+        entries.push_back({"bench/publish/" + std::to_string(i % 256), payload, qos, false});
+    }
+
+    auto singleStart = std::chrono::steady_clock::now();
+    for(const auto& entry : entries){
+        mqttClient.publish(entry.topic, entry.payload, entry.qos, entry.retain);
+    }
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        completed.wait(lock, [&] { return acknowledged.load() >= count; });
+    }
+    auto singleEnd = std::chrono::steady_clock::now();
+
+    acknowledged = 0;
+    auto batchStart = std::chrono::steady_clock::now();
+    MqttCallbacks::PublishResult batchResult = mqttClient.publishBatch(entries).get();
+    auto batchEnd = std::chrono::steady_clock::now();
+
+    double singleSeconds = std::chrono::duration<double>(singleEnd - singleStart).count();
+    double batchSeconds = std::chrono::duration<double>(batchEnd - batchStart).count();
+    std::cout << "messages=" << count << " payload=" << payloadSize << " qos=" << qos
+        << " single_msgs_per_s=" << count / singleSeconds
+        << " batch_msgs_per_s=" << count / batchSeconds
+        << " batch_result=" << (batchResult == MqttCallbacks::PUBLISH_SUCCESS ? "success" : "failure") << std::endl;
+
+    mqttClient.finish();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,82 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "MqttCallbacks.hpp"
+#include "TopicTrie.hpp"
+
+// Compares dispatch lookup cost of the topic trie against the linear scan of every
+// registered filter, for per-device filter sets of increasing size.
+
+static std::vector<std::string> makeFilters(size_t count){
+    std::vector<std::string> filters;
+    filters.reserve(count);
+    for(size_t i = 0; i < count; ++i){
+        std::string device = "site" + std::to_string(i % 64) + "/device" + std::to_string(i);
+        switch(i % 4){
+            case 0: filters.push_back("fleet/" + device + "/state"); break;
+            case 1: filters.push_back("fleet/" + device + "/+/value"); break;
+            case 2: filters.push_back("fleet/" + device + "/#"); break;
+            default: filters.push_back("fleet/+/device" + std::to_string(i) + "/cmd"); break;
+        }
+    }
+    return filters;
+}
+
+static std::vector<std::string> makeTopics(size_t filterCount, size_t count){
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<size_t> pick(0, filterCount - 1);
+    std::vector<std::string> topics;
+    topics.reserve(count);
+    for(size_t i = 0; i < count; ++i){
+        size_t device = pick(rng);
+        topics.push_back("fleet/site" + std::to_string(device % 64) + "/device" + std::to_string(device) + "/sensor/value");
+    }
+    return topics;
+}
+
+int main(int argc, char *argv[]){
+    for(size_t filterCount : {10, 1000, 100000}){
+        std::vector<std::string> filters = makeFilters(filterCount);
+        // keep the linear scan runs short for big filter sets
+        size_t topicCount = std::max<size_t>(200, 20000000 / (filterCount * 10));
+        std::vector<std::string> topics = makeTopics(filterCount, topicCount);
+
+        TopicTrie<size_t> trie;
+        for(size_t i = 0; i < filters.size(); ++i){
+            trie.insert(filters[i], i);
+        }
+
+        size_t scanMatches = 0;
+        auto scanStart = std::chrono::steady_clock::now();
+        for(const std::string& topic : topics){
+            for(const std::string& filter : filters){
+                if(MqttCallbacks::isMqttTopicIncluded(topic, filter)){
+                    ++scanMatches;
+                }
+            }
+        }
+        auto scanEnd = std::chrono::steady_clock::now();
+
+        size_t trieMatches = 0;
+        auto trieStart = std::chrono::steady_clock::now();
+        for(const std::string& topic : topics){
+            trie.forEachMatch(topic, [&trieMatches](size_t){
+                ++trieMatches;
+            });
+        }
+        auto trieEnd = std::chrono::steady_clock::now();
+
+        double scanNs = std::chrono::duration<double, std::nano>(scanEnd - scanStart).count() / topics.size();
+        double trieNs = std::chrono::duration<double, std::nano>(trieEnd - trieStart).count() / topics.size();
+        std::cout << "filters=" << filterCount
+            << " scan_ns_per_msg=" << scanNs << " scan_matches=" << scanMatches
+            << " trie_ns_per_msg=" << trieNs << " trie_matches=" << trieMatches
+            << " speedup=" << scanNs / trieNs << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,30 @@
+#include "coro/AsyncMqttClient.hpp"
+#include "coro/CoroTask.hpp"
+
+// echoes every message of "echo/in" to "echo/out", waiting for each PUBACK
+CoroTask<void> echo(AsyncMqttClient& client){
+    std::shared_ptr<MessageStream> stream = client.stream("echo/in");
+    co_await client.connect();
+    std::cout << "Connected" << std::endl;
+    while(std::optional<MessageStream::message> msg = co_await stream->next()){
+        int messageId = co_await client.publish("echo/out", msg->payload, 1);
+        std::cout << "Echoed message " << messageId << ": " << msg->payload << std::endl;
+    }
+}
+
+int main(int argc, char *argv[]){
+    // the executor outlives the client, whose handlers and listeners resume coroutines on it
+    CoroExecutor executor(2);
+    MqttClient mqttClient("localhost", 1883, "me-coro");
+    AsyncMqttClient client(mqttClient, executor);
+
+    std::future<void> done = spawn(executor, echo(client));
+
+    int c;
+    do {
+        c = std::tolower(std::cin.get());
+    } while(c != 'q');
+
+    mqttClient.finish();
+    return EXIT_SUCCESS;
+}
@@ -1,3 +1,4 @@
+#include "CborCodec.hpp"
 #include "MqttClient.hpp"
 
 int main(int argc, char *argv[]){
@@ -12,14 +13,23 @@ int main(int argc, char *argv[]){
         std::cout << "Me-too is connected!" << std::endl;
     });
 
-    mqttClient.on("test", [] (std::string payload) -> std::string {
+    mqttClient.on("test", [] (std::string topic, std::string payload) -> std::string {
         std::cout << "Message received: " << payload << std::endl;
         return "This is a response in case mqttv5 publisher asks for it";
     });
 
-    otherMqttClient.on("test2", [] (std::string payload) -> std::string {
+    // handlers taking views get the topic and payload without copies
+    otherMqttClient.on("test2", [] (std::string_view topic, std::string_view payload, std::string& response) {
         std::cout << "Message received: " << payload << std::endl;
-        return "This is a response in case mqttv5 publisher asks for it";
+        response = "This is a response in case mqttv5 publisher asks for it";
+    });
+
+    // typed handlers get the payload decoded once, however many of them match
+    auto cbor = std::make_shared<CborCodec>();
+    otherMqttClient.on("sensors/+", cbor, [] (std::string_view topic, const CborValue& reading) {
+        if(const CborValue* temperature = reading.find("temperature")){
+            std::cout << topic << " temperature: " << temperature->asDouble() << std::endl;
+        }
     });
 
     mqttClient.start();
@@ -29,13 +39,16 @@ int main(int argc, char *argv[]){
     do {
         c = std::tolower(std::cin.get());
         if(c == 'p'){
-            mqttClient.publish("test", "This was published by the first client");
+            mqttClient.publish("test", "This was published by the first client", 0, false);
         } else if(c == 's'){
             // subscribe the other client to the first topic
-            mqttClient.on("test", [] (std::string payload) -> std::string {
+            mqttClient.on("test", [] (std::string topic, std::string payload) -> std::string {
                 std::cout << "The other one: message received - " << payload << std::endl;
                 return "This is a response in case mqttv5 publisher asks for it";
             });
+        } else if(c == 'u'){
+            // and take it back, the broker stops sending it
+            mqttClient.unsubscribe("test");
         }
         
     } while(c != 'q');
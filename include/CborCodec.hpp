@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "PayloadCodec.hpp"
+
+// One decoded CBOR (RFC 8949) data item. Byte and text strings are views into the payload
+// they were decoded from, so decoding copies no string data; for encoding they must point
+// to data alive until encode returns.
+struct CborValue {
+    enum Type {
+        CBOR_UNSIGNED = 0,
+        CBOR_NEGATIVE = 1,
+        CBOR_BYTES = 2,
+        CBOR_TEXT = 3,
+        CBOR_ARRAY = 4,
+        CBOR_MAP = 5,
+        CBOR_BOOL = 6,
+        CBOR_NULL = 7,
+        CBOR_UNDEFINED = 8,
+        CBOR_SIMPLE = 9,
+        CBOR_FLOAT = 10
+    };
+
+    Type type = CBOR_NULL;
+    // CBOR_UNSIGNED: the value, CBOR_NEGATIVE: -1 minus the value, CBOR_BOOL: 0 or 1,
+    // CBOR_SIMPLE: the simple value number
+    uint64_t integer = 0;
+    double floating = 0;
+    // CBOR_BYTES and CBOR_TEXT
+    std::string_view bytes;
+    // CBOR_ARRAY
+    std::vector<CborValue> items;
+    // CBOR_MAP, in encoded order
+    std::vector<std::pair<CborValue, CborValue>> entries;
+    // tags preceding the item, outermost first
+    std::vector<uint64_t> tags;
+
+    static CborValue fromInt(int64_t value);
+    static CborValue fromUnsigned(uint64_t value);
+    static CborValue fromDouble(double value);
+    static CborValue fromBool(bool value);
+    static CborValue fromText(std::string_view text);
+    static CborValue fromBytes(std::string_view bytes);
+    static CborValue array(std::vector<CborValue> items);
+    static CborValue map(std::vector<std::pair<CborValue, CborValue>> entries);
+
+    bool isInteger() const;
+    // throws std::out_of_range if the item is not an integer or does not fit
+    int64_t asInt64() const;
+    // integers are converted, throws std::out_of_range for other types
+    double asDouble() const;
+
+    // value of the first entry with text key in a map, nullptr if none or not a map
+    const CborValue* find(std::string_view key) const;
+};
+
+// Hand-written CBOR codec: definite and indefinite length arrays and maps, tags, half,
+// single and double floats. Indefinite length (chunked) strings are refused since they
+// cannot be returned as views. Malformed, truncated or too deeply nested payloads and
+// trailing bytes throw std::invalid_argument.
+class CborCodec: public PayloadCodec<CborValue> {
+    public:
+        static constexpr int maxDepth = 128;
+
+        CborValue decode(std::string_view payload) const override;
+
+        // shortest head for every integer and length, floats as doubles
+        void encode(const CborValue& value, std::string& out) const override;
+};
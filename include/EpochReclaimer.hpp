@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Deferred reclamation for structures read without locks. Readers hold a guard around their
+// reads; what a writer unlinks is retired with the function freeing it, run once no reader
+// that could still see it is left. Readers only touch striped counters, they never wait.
+// Writers must be serialized by the caller.
+class EpochReclaimer {
+    private:
+        // readers in each epoch parity, striped over cache lines by thread
+        static constexpr size_t readerStripes = 16;
+        struct alignas(64) readerStripe {
+            std::atomic<int64_t> count[2] = {{0}, {0}};
+        };
+        mutable readerStripe _readers[readerStripes];
+        std::atomic<uint64_t> _epoch{0};
+        // retired during even and odd epochs
+        std::vector<std::function<void()>> _retired[2];
+        size_t _reclaimBatch;
+
+        uint64_t enter() const;
+        void exit(uint64_t epoch) const;
+
+    public:
+        class guard {
+            private:
+                const EpochReclaimer& _reclaimer;
+                uint64_t _epoch;
+
+            public:
+                explicit guard(const EpochReclaimer& reclaimer) : _reclaimer(reclaimer), _epoch(reclaimer.enter()) {}
+                ~guard(){
+                    _reclaimer.exit(_epoch);
+                }
+                guard(const guard&) = delete;
+                guard& operator=(const guard&) = delete;
+        };
+
+        // retirements between two attempts to free them
+        explicit EpochReclaimer(size_t reclaimBatch = 1);
+        // readers must be done, frees everything retired
+        ~EpochReclaimer();
+
+        EpochReclaimer(const EpochReclaimer&) = delete;
+        EpochReclaimer& operator=(const EpochReclaimer&) = delete;
+
+        // writer side: release runs once the readers that may see what it frees are gone
+        void retire(std::function<void()> release);
+
+        // frees what was retired two epochs ago if no reader is left there, and moves on
+        void reclaim();
+};
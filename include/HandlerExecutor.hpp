@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MpmcQueue.hpp"
+#include "Parker.hpp"
+
+// Dedicated, bounded pool of threads for the handlers of some topic filters, so slow
+// handlers (a database write, a remote call) only delay the messages of their own filters.
+// Tasks get the index of the thread running them.
+class HandlerExecutor {
+    public:
+        using task = std::function<void(size_t threadIndex)>;
+
+    private:
+        std::string _name;
+        MpmcQueue<task> _tasks;
+        Parker _notEmpty;
+        std::atomic<bool> _stopExecution{false};
+        std::vector<std::thread> _threads;
+
+        void threadLoop(size_t threadIndex);
+
+    public:
+        HandlerExecutor(std::string name, int numThreads, size_t queueCapacity);
+        // runs the tasks already posted, then joins the threads
+        ~HandlerExecutor();
+
+        HandlerExecutor(const HandlerExecutor&) = delete;
+        HandlerExecutor& operator=(const HandlerExecutor&) = delete;
+
+        // returns false, without running it, when queueCapacity tasks are already waiting
+        bool tryPost(task work);
+
+        const std::string& name() const;
+        size_t numThreads() const;
+        size_t queued() const;
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+// built when MQTT_CLIENT_WITH_SIMDJSON is on
+#ifdef MQTT_CLIENT_WITH_SIMDJSON
+
+#include <memory>
+
+#include <simdjson.h>
+
+#include "PayloadCodec.hpp"
+
+// JSON codec on simdjson's DOM parser. Each codec keeps one parser per worker thread, so
+// decoding reuses its buffers, and the element returned points into that parser: it stays
+// valid while the message is dispatched, until the same codec decodes the next message
+// on that thread. A thread drops the parsers of destroyed codecs when it next needs a new one.
+class JsonCodec: public PayloadCodec<simdjson::dom::element> {
+    private:
+        // names the codec's parsers in the per thread lists, expired once the codec is destroyed
+        std::shared_ptr<const char> _parserKey = std::make_shared<const char>('\0');
+
+    public:
+        JsonCodec() = default;
+        // a copy decodes with parsers of its own
+        JsonCodec(const JsonCodec& other);
+        JsonCodec& operator=(const JsonCodec& other);
+
+        // throws std::invalid_argument with simdjson's error message
+        simdjson::dom::element decode(std::string_view payload) const override;
+
+        // minified
+        void encode(const simdjson::dom::element& value, std::string& out) const override;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <mqtt/async_client.h>
+
+#include "EpochReclaimer.hpp"
+
+// Last message of every topic it is fed, for "what is the current value of X" without
+// waiting for a retained message. Holds the arrived messages themselves, so the payload
+// is shared with the message and a read hands out a reference instead of a copy.
+//
+// One writer (the paho callback thread) and any number of readers. Readers never lock:
+// they find the topic in an open-addressed table and take a reference to its message
+// inside an EpochReclaimer guard, and whatever the writer replaces is freed only once no
+// reader that may see it is left. Past budgetBytes the least recently updated topics are evicted.
+class LastValueCache {
+    public:
+        struct counters {
+            uint64_t updates = 0;
+            uint64_t evictions = 0;
+            // retained messages with an empty payload, which clear their topic
+            uint64_t cleared = 0;
+            uint64_t entries = 0;
+            uint64_t bytes = 0;
+        };
+
+    private:
+        struct holder {
+            mqtt::const_message_ptr msg;
+            size_t bytes;
+        };
+
+        struct entry {
+            std::string topic;
+            size_t hash;
+            // null once cleared or evicted, the entry stays for readers until the table is rebuilt
+            std::atomic<holder*> value{nullptr};
+            // least recently updated list of the entries with a value, writer only
+            entry* older = nullptr;
+            entry* newer = nullptr;
+        };
+
+        struct table {
+            explicit table(size_t capacity);
+            size_t mask;
+            std::unique_ptr<std::atomic<entry*>[]> slots;
+        };
+
+        // replaced values, entries and tables are freed once no reader may see them
+        EpochReclaimer _reclaimer{64};
+
+        std::atomic<table*> _table;
+        // entries in the table, with or without a value
+        size_t _used = 0;
+        entry* _oldest = nullptr;
+        entry* _newest = nullptr;
+
+        std::atomic<size_t> _budgetBytes;
+        std::atomic<uint64_t> _bytes{0};
+        std::atomic<uint64_t> _entries{0};
+        std::atomic<uint64_t> _updates{0};
+        std::atomic<uint64_t> _evictions{0};
+        std::atomic<uint64_t> _cleared{0};
+
+        entry* find(const table& current, std::string_view topic, size_t hash) const;
+        entry* insert(const std::string& topic, size_t hash);
+        // a table sized for the entries with a value, retiring the others
+        void rebuild();
+        void unlinkRecent(entry* updated);
+        void clear(entry* stale);
+
+    public:
+        explicit LastValueCache(size_t budgetBytes = 64 << 20);
+        // readers must be done
+        ~LastValueCache();
+
+        LastValueCache(const LastValueCache&) = delete;
+        LastValueCache& operator=(const LastValueCache&) = delete;
+
+        // bytes of topics and payloads kept, least recently updated topics go first past it
+        void setBudget(size_t budgetBytes);
+
+        // writer side, from one thread
+        void update(const mqtt::const_message_ptr& msg);
+
+        // last message of topic, null if none
+        mqtt::const_message_ptr latest(std::string_view topic) const;
+
+        // last message of every topic matching filter, in no particular order
+        std::vector<mqtt::const_message_ptr> snapshot(const std::string& filter) const;
+
+        counters getCounters() const;
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// HDR-style log-linear histogram of nanosecond durations: every power of two is split
+// into 8 linear sub-buckets, so any recorded value is known within 12.5% while the
+// whole range up to ~18 minutes fits in a few hundred fixed buckets. Recording is a
+// handful of relaxed atomic adds, reads are safe while other threads record.
+class LatencyHistogram {
+    public:
+        static constexpr int subBucketBits = 3;
+        static constexpr int subBuckets = 1 << subBucketBits;
+        // values at or above 2^maxExponent ns land in the last bucket
+        static constexpr int maxExponent = 40;
+        static constexpr size_t bucketCount = subBuckets + (maxExponent - subBucketBits) * subBuckets;
+
+        struct summary {
+            uint64_t count = 0;
+            uint64_t sum = 0;
+            uint64_t max = 0;
+            uint64_t p50 = 0;
+            uint64_t p90 = 0;
+            uint64_t p99 = 0;
+            uint64_t p999 = 0;
+        };
+
+    private:
+        std::array<std::atomic<uint64_t>, bucketCount> _buckets{};
+        std::atomic<uint64_t> _count{0};
+        std::atomic<uint64_t> _sum{0};
+        std::atomic<uint64_t> _max{0};
+
+        static size_t bucketIndex(uint64_t value);
+        // highest value falling in the bucket
+        static uint64_t bucketValue(size_t index);
+
+    public:
+        void record(uint64_t nanoseconds);
+
+        // adds this histogram's buckets to counts, for merging several histograms
+        void addTo(std::array<uint64_t, bucketCount>& counts, summary& totals) const;
+
+        summary summarize() const;
+
+        static summary summarize(const std::array<uint64_t, bucketCount>& counts, summary totals);
+};
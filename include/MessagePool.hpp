@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <mqtt/async_client.h>
+
+// Recycles outgoing paho messages together with their payload buffers and interned topics,
+// so publishing in steady state does not allocate: a slot is reused once paho and the
+// caller dropped every reference to its message, its payload buffer is overwritten in place
+// while it is large enough, and topics seen before share one immutable string.
+// When every slot is in use the pool falls back to a plain mqtt::make_message.
+class MessagePool {
+    public:
+        struct counters {
+            // messages handed out
+            uint64_t acquired = 0;
+            // handed out from a recycled slot without allocating
+            uint64_t recycled = 0;
+            // message objects created, including the fallbacks when the pool is exhausted
+            uint64_t messageAllocations = 0;
+            // payload buffers created or grown
+            uint64_t payloadAllocations = 0;
+            // topic strings created
+            uint64_t topicAllocations = 0;
+        };
+
+    private:
+        struct slot {
+            std::atomic<bool> claimed{false};
+            mqtt::message_ptr msg;
+            std::shared_ptr<std::string> payload;
+            bool hasProperties = false;
+        };
+
+        std::vector<slot> _slots;
+
+        size_t _maxTopics;
+        std::shared_mutex _topicsMutex;
+        std::unordered_map<std::string, mqtt::string_ref> _topics;
+
+        std::atomic<uint64_t> _acquired{0};
+        std::atomic<uint64_t> _recycled{0};
+        std::atomic<uint64_t> _messageAllocations{0};
+        std::atomic<uint64_t> _payloadAllocations{0};
+        std::atomic<uint64_t> _topicAllocations{0};
+
+        mqtt::string_ref internTopic(const std::string& topic);
+
+        void fill(slot& freeSlot, const std::string& topic, std::string_view payload, int qos, bool retain, const mqtt::properties* props);
+
+    public:
+        explicit MessagePool(size_t slots = 4096, size_t maxTopics = 4096);
+
+        MessagePool(const MessagePool&) = delete;
+        MessagePool& operator=(const MessagePool&) = delete;
+
+        mqtt::message_ptr acquire(const std::string& topic, std::string_view payload, int qos, bool retain);
+        mqtt::message_ptr acquire(const std::string& topic, std::string_view payload, int qos, bool retain, const mqtt::properties& props);
+
+        counters getCounters() const;
+};
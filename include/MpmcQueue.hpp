@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+// Bounded lock-free multi-producer multi-consumer ring buffer (Vyukov's design).
+// Every cell carries a sequence number that tells producers and consumers whether
+// the cell is free for the current lap, so a push or pop is one CAS on the shared
+// position plus one store on the cell, without any lock.
+template <typename T>
+class MpmcQueue {
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        static constexpr size_t cacheLineSize = 64;
+
+        std::unique_ptr<Cell[]> _cells;
+        size_t _mask;
+
+        // producers and consumers positions on separate cache lines
+        alignas(cacheLineSize) std::atomic<size_t> _enqueuePos{0};
+        alignas(cacheLineSize) std::atomic<size_t> _dequeuePos{0};
+
+        static size_t roundUpPowerOfTwo(size_t value){
+            size_t result = 2;
+            while(result < value){
+                result <<= 1;
+            }
+            return result;
+        }
+
+    public:
+        // capacity is rounded up to a power of two
+        explicit MpmcQueue(size_t capacity)
+            : _cells(new Cell[roundUpPowerOfTwo(capacity)]), _mask(roundUpPowerOfTwo(capacity) - 1) {
+            for(size_t i = 0; i <= _mask; ++i){
+                _cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        MpmcQueue(const MpmcQueue&) = delete;
+        MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+        // returns false when the queue is full, value is only moved from on success
+        bool tryPush(T&& value){
+            size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+            while(true){
+                Cell& cell = _cells[pos & _mask];
+                size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+                if(diff == 0){
+                    if(_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                        cell.value = std::move(value);
+                        cell.sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if(diff < 0){
+                    return false;
+                } else {
+                    pos = _enqueuePos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // returns false when the queue is empty
+        bool tryPop(T& value){
+            size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+            while(true){
+                Cell& cell = _cells[pos & _mask];
+                size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+                if(diff == 0){
+                    if(_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                        value = std::move(cell.value);
+                        cell.sequence.store(pos + _mask + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if(diff < 0){
+                    return false;
+                } else {
+                    pos = _dequeuePos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        size_t capacity() const {
+            return _mask + 1;
+        }
+
+        // approximate while producers or consumers are running
+        size_t size() const {
+            size_t enqueued = _enqueuePos.load(std::memory_order_relaxed);
+            size_t dequeued = _dequeuePos.load(std::memory_order_relaxed);
+            return enqueued > dequeued ? enqueued - dequeued : 0;
+        }
+};
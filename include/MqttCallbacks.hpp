@@ -1,14 +1,145 @@
 #pragma once
 
 #include <mqtt/async_client.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <string_view>
 #include <thread>
+#include <type_traits>
+#include <unordered_map>
+
+#include "EpochReclaimer.hpp"
+#include "HandlerExecutor.hpp"
+#include "LastValueCache.hpp"
+#include "MessagePool.hpp"
+#include "MpmcQueue.hpp"
+#include "MqttMetrics.hpp"
+#include "PayloadCodec.hpp"
+#include "PayloadCompression.hpp"
+#include "Parker.hpp"
+#include "RequestTracker.hpp"
+#include "SpscQueue.hpp"
+#include "TopicAliases.hpp"
+#include "TopicTrie.hpp"
 
 class MqttCallbacks: public virtual mqtt::callback, public virtual mqtt::iaction_listener
 {
     public:
         enum PublishResult {
             PUBLISH_SUCCESS = 0,
-            PUBLISH_FAILURE = 1
+            PUBLISH_FAILURE = 1,
+            // replaced by a later publish of the same topic before it was sent, see PublishShaper
+            PUBLISH_COALESCED = 2,
+            // over the rate limit of its topic, see PublishShaper
+            PUBLISH_DROPPED = 3
+        };
+
+        // what enqueue does when the receive queue is full
+        enum BackpressurePolicy {
+            // wait for a worker to free a slot, stalling the paho callback thread
+            BACKPRESSURE_BLOCK = 0,
+            // discard the oldest queued message to make room. Ordered shards can only be
+            // popped by their own worker, so there the arriving message is discarded instead
+            BACKPRESSURE_DROP_OLDEST = 1,
+            // discard the arriving message
+            BACKPRESSURE_DROP_NEWEST = 2
+        };
+
+        // how arriving messages are spread over the workers
+        enum DispatchMode {
+            // any worker takes any message from one shared queue
+            DISPATCH_SHARED = 0,
+            // messages with the same ordering key always go to the same worker, through
+            // its own queue, so they are handled one at a time and in arrival order.
+            // Messages with an empty key go to the shared queue that idle workers drain
+            DISPATCH_ORDERED = 1
+        };
+
+        // Handler receiving views into the topic and payload held by the arrived message, valid until
+        // it returns. A response for MQTT v5 requests is written into response, a buffer reused
+        // across messages by each worker thread and handed over empty
+        using messageViewHandler = std::function<void(std::string_view topic, std::string_view payload, std::string& response)>;
+
+        struct dispatchSettings {
+            int numWorkers = 4;
+            DispatchMode mode = DISPATCH_SHARED;
+            // ordering key for DISPATCH_ORDERED, the topic when not set. The view must point into
+            // the message (topic, payload or properties); an empty key means no ordering is needed
+            std::function<std::string_view(const mqtt::const_message_ptr& msg)> orderingKey = nullptr;
+            // capacity of the shared queue and of each ordered worker queue, rounded up to a power of two
+            size_t queueCapacity = 16384;
+            BackpressurePolicy backpressure = BACKPRESSURE_BLOCK;
+            // queue polls before a worker (or a blocked producer) parks
+            int spinCount = 128;
+        };
+
+        // how a topic filter is subscribed
+        struct subscriptionSettings {
+            int qos = 0;
+            // MQTT v5 No Local, Retain As Published and Retain Handling
+            mqtt::subscribe_options options;
+            // subscribes as $share/<shareGroup>/<filter> when set, so the broker spreads the
+            // messages over every client of the group instead of sending each to all of them.
+            // Handlers are matched on the topic alone, not on the subscription a copy was
+            // delivered for: next to a plain handler whose filter overlaps (a/# with
+            // $share/g/a/#), both run for every copy the broker sends, the group's included.
+            // Keep a shared filter apart from this client's other filters
+            std::string shareGroup;
+            // where the handler runs: empty for the shared worker pool, "inline" for the paho
+            // callback thread as the message arrives (only for handlers that never block), or
+            // the name of a pool added with addExecutor
+            std::string executor;
+            // run time after which the handler is reported with HANDLER_TIMEOUT, 0 for none.
+            // A handler cannot be interrupted: it is reported while still running and keeps
+            // its thread until it returns
+            std::chrono::milliseconds deadline{0};
+        };
+
+        enum HandlerErrorKind {
+            // the handler threw
+            HANDLER_EXCEPTION = 0,
+            // the handler ran past its deadline
+            HANDLER_TIMEOUT = 1,
+            // the queue of the handler's executor was full, the handler did not run
+            HANDLER_REJECTED = 2,
+            // the handler ran but its response could not be published
+            HANDLER_RESPONSE_FAILED = 3,
+            // a compressed payload could not be inflated, no handler ran. Reported with an
+            // empty topicFilter
+            HANDLER_INFLATE_FAILED = 4
+        };
+
+        struct handlerError {
+            HandlerErrorKind kind;
+            // subscribed filter of the handler
+            std::string topicFilter;
+            std::string topic;
+            // what the handler threw, for HANDLER_EXCEPTION, what publishing its response
+            // threw, for HANDLER_RESPONSE_FAILED, or why inflating failed, for HANDLER_INFLATE_FAILED
+            std::exception_ptr exception;
+            // run time when reported, for HANDLER_EXCEPTION and HANDLER_TIMEOUT
+            std::chrono::nanoseconds elapsed{0};
+        };
+
+        // when and how the connection is re-established after it was lost or an attempt failed
+        struct reconnectSettings {
+            bool enabled = true;
+            // delay before attempt n is initialDelay * multiplier^n, capped at maxDelay
+            std::chrono::milliseconds initialDelay{500};
+            std::chrono::milliseconds maxDelay{60000};
+            double multiplier = 2.0;
+            // fraction of each delay that is randomized, 0 to 1, so a fleet losing the same
+            // broker does not come back all at once
+            double jitter = 0.5;
+            // topic filters per SUBSCRIBE packet when resubscribing after a connection
+            size_t subscribeBatchSize = 128;
         };
 
     private:
@@ -20,15 +151,153 @@ class MqttCallbacks: public virtual mqtt::callback, public virtual mqtt::iaction
         std::function<void()> _onConnectCallback = nullptr;
         std::function<void()> _onDisconnectCallback = nullptr;
         std::function<void(PublishResult result, int messageId, mqtt::const_message_ptr msg)> _onPublishResultCallback = nullptr;
-        std::vector<std::tuple<std::string, std::function<std::string(std::string, std::string)>>> messageHandlers;
-        
+        std::function<void(const handlerError& error)> _onHandlerErrorCallback = nullptr;
+        // the client's own stages, told before the user callbacks
+        std::function<void(bool connected)> _connectionStateListener = nullptr;
+        // what every kind of handler is stored as: typed handlers take their value from decoded
+        using dispatchHandler = std::function<void(std::string_view topic, std::string_view payload, DecodedPayloads& decoded, std::string& response)>;
+
+        // what a thread running handlers is doing, polled by the deadline watchdog. One per
+        // worker, per named executor thread and for the paho callback thread
+        struct runningHandler {
+            // bumped for every handler run with a deadline
+            std::atomic<uint64_t> runId{0};
+            // last run reported as timed out, by the watchdog or by the thread itself
+            std::atomic<uint64_t> reportedRunId{0};
+            std::atomic<int64_t> startedAt{0};
+            // steady clock ns, 0 while no handler with a deadline runs
+            std::atomic<int64_t> deadlineAt{0};
+            // stats of the handler running with a deadline, kept while the watchdog reads its filter
+            std::mutex handlerMutex;
+            std::shared_ptr<MqttMetrics::filterStats> handler;
+        };
+
+        // a pool added with addExecutor, with the running slot of each of its threads
+        struct namedExecutor {
+            std::unique_ptr<HandlerExecutor> executor;
+            std::vector<runningHandler*> slots;
+        };
+
+        // a handler added with on, never modified once registered
+        struct registeredHandler {
+            // subscribed filter, $share/... included
+            std::string topicFilter;
+            dispatchHandler handler;
+            std::shared_ptr<MqttMetrics::filterStats> stats;
+            subscriptionSettings settings;
+            // null for the shared workers and for inline handlers
+            namedExecutor* executor;
+        };
+
+        // immutable snapshot of the handlers in registration order, replaced as a whole by on,
+        // off and cache. Topic filter indexes over them, values are positions in handlers. Inline
+        // handlers have their own, matched on the paho callback thread. The filters of the
+        // last-value cache with their qos, and their index, travel with the handlers
+        struct handlerTable {
+            std::vector<std::shared_ptr<const registeredHandler>> handlers;
+            TopicTrie<size_t> index;
+            TopicTrie<size_t> inlineIndex;
+            std::vector<std::pair<std::string, int>> cachedFilters;
+            TopicTrie<int> cachedIndex;
+        };
+
+        // dispatch reads the current table inside a guard of _handlersReclaimer and never locks;
+        // on and off build the next table under _handlersMutex and retire the previous one.
+        // Tasks posted to executors keep their handler alive themselves
+        std::atomic<handlerTable*> _handlers{new handlerTable()};
+        EpochReclaimer _handlersReclaimer;
+        std::mutex _handlersMutex;
+        std::atomic<bool> _hasInlineHandlers{false};
+
+        // publishes a table with the handlers of the current one kept by keep, plus added if any,
+        // and the cached filters of the current one plus addedCache if any, replacing its filter. Throws
+        // std::invalid_argument for a malformed added filter, the current table staying
+        template <typename Keep>
+        void replaceHandlers(Keep keep, std::shared_ptr<const registeredHandler> added, const std::pair<std::string, int>* addedCache = nullptr);
+
+        // executors by name, added before the handlers using them and kept until destruction
+        std::unordered_map<std::string, namedExecutor> _executors;
+
+        std::mutex _runningMutex;
+        // deque so the slots never move
+        std::deque<runningHandler> _running;
+        runningHandler* _inlineSlot = nullptr;
+
+        runningHandler* addRunningSlot();
+
+        // deadline watchdog, started with the first handler that has a deadline
+        std::thread _watchdogThread;
+        std::mutex _watchdogMutex;
+        std::condition_variable _watchdogCondition;
+        bool _stopWatchdog = false;
+        std::once_flag _watchdogStarted;
+
+        void watchdogLoop();
+
+        void reportHandlerError(handlerError error);
+
+        // runs a handler and publishes its response, reporting what it throws and an overrun
+        // of its deadline. Returns false if it threw
+        bool runHandler(const registeredHandler& messageHandler, const mqtt::const_message_ptr& msg, DecodedPayloads& decoded, std::string& response, runningHandler& slot);
+
+        MqttMetrics _metrics;
+
+        // outgoing messages, for responses here and for MqttClient publishes
+        MessagePool _messagePool;
+
+        // client side of request/response: one response topic shared by every request,
+        // subscribed on the first request and routed to the tracker before the handlers
+        RequestTracker _requestTracker;
+        std::string _responseTopic;
+        std::once_flag _responseTopicSubscribed;
+        std::atomic<bool> _requestsEnabled{false};
+
+        reconnectSettings _reconnectSettings;
+
+        TopicAliases _topicAliases;
+
+        // compressed payloads are inflated on the paho callback thread into messages of their own pool
+        PayloadCompression _compression;
+        MessagePool _inflatedMessages{1024};
+
+        // the inflated copy of a compressed msg, msg itself otherwise, null if it cannot be
+        // inflated (reported with HANDLER_INFLATE_FAILED)
+        mqtt::const_message_ptr inflate(mqtt::const_message_ptr msg);
+
+        // last value of every topic matching a cached filter of the handler table, fed on the
+        // paho callback thread
+        LastValueCache _lastValues;
+        std::atomic<bool> _hasCachedFilters{false};
+
+        // reconnect scheduler: one thread, started on the first scheduled attempt, sleeping
+        // until the pending attempt is due so no paho thread ever waits out a backoff
+        std::thread _reconnectThread;
+        std::mutex _reconnectMutex;
+        std::condition_variable _reconnectCondition;
+        std::optional<std::chrono::steady_clock::time_point> _reconnectAt;
+        int _reconnectAttempt = 0;
+        bool _reconnectEnabled = true;
+        bool _stopReconnect = false;
+        std::minstd_rand _jitterRandom{std::random_device()()};
+
+        // backoff before the given attempt, jitter applied
+        std::chrono::milliseconds reconnectDelay(int attempt);
+
+        // schedules the next attempt unless one is pending or reconnection is off
+        void scheduleReconnect();
+
+        void reconnectLoop();
+
         void reconnect();
 
+        // subscribes every handler and cached filter (and the response topic) in batched SUBSCRIBE packets
+        void resubscribe();
+
         // (Re)connection success in callback class
         void connected(const std::string& cause) override;
         
         // callback for when the connection is lost.
-        // This will initiate the attempt to manually reconnect.
+        // This will schedule the attempt to manually reconnect.
         void connection_lost(const std::string& cause) override;
 
         // callback for when a message arrives.
@@ -46,43 +315,196 @@ class MqttCallbacks: public virtual mqtt::callback, public virtual mqtt::iaction
         // Callback for message delivery complete - not used yet
         void delivery_complete(mqtt::delivery_token_ptr tok) override;
 
-        bool isMqttTopicIncluded(const std::string& topic, const std::string& filter);
+        // runs the handlers matching msg on this worker and hands the others to their executors.
+        // Returns the number of handlers that threw
+        size_t messageArrivedHandler(mqtt::const_message_ptr msg, runningHandler& slot);
+
+        void inlineHandlers(const mqtt::const_message_ptr& msg);
+
+        void addHandler(std::string topicFilter, dispatchHandler messageHandler, subscriptionSettings settings);
 
-        void messageArrivedHandler(mqtt::const_message_ptr msg);
+        dispatchSettings _dispatchSettings;
 
         // Vector to store worker threads 
         std::vector<std::thread> rcvHandlersThreads; 
     
-        // Queue of messages to be handled by workers
-        std::queue<mqtt::const_message_ptr> msgQueue; 
-    
-        // Mutex to synchronize access to shared data 
-        std::mutex queueMutex; 
+        // Bounded lock-free queue of messages to be handled by workers,
+        // created when the workers start
+        struct queuedMessage {
+            mqtt::const_message_ptr msg;
+            // steady clock ns when enqueued, 0 while metrics are off
+            int64_t enqueuedAt = 0;
+        };
+        std::unique_ptr<MpmcQueue<queuedMessage>> msgQueue; 
+        std::once_flag _workersStarted;
+        // set once msgQueue and _orderedShards are built, for the metrics gauges reading them
+        std::atomic<bool> _workersReady{false};
     
-        // Condition variable to signal changes in the state of 
-        // the messages queue 
-        std::condition_variable conditionVariable; 
+        // workers park here when the queue is empty
+        Parker _queueNotEmpty;
+
+        // per worker queue for DISPATCH_ORDERED, fed only by the paho callback thread
+        struct orderedShard {
+            explicit orderedShard(size_t capacity) : msgQueue(capacity) {}
+            SpscQueue<queuedMessage> msgQueue;
+            // the shard's worker parks here when both its queue and the shared queue are empty
+            Parker notEmpty;
+        };
+        std::vector<std::unique_ptr<orderedShard>> _orderedShards;
+
+        // first worker checked when waking someone for the shared queue in DISPATCH_ORDERED
+        size_t _nextWakeup = 0;
+
+        // producer parks here when the queue is full under BACKPRESSURE_BLOCK
+        Parker _queueNotFull;
     
         // Flag to indicate whether the thread pool should stop 
         // or not 
-        bool stopExecution = false;
+        std::atomic<bool> stopExecution{false};
+
+        // messages discarded by the backpressure policy
+        std::atomic<uint64_t> _droppedMessages{0};
 
         // Enqueue message for handling by the thread pool 
         void enqueue(mqtt::const_message_ptr msg);
 
+        // pushes following the backpressure policy, returns false if msg was discarded
+        template <typename Queue>
+        bool push(Queue& queue, queuedMessage& item);
+
+        // Dequeue message for a worker, spinning then parking while its queues are empty.
+        // Returns false once the pool is stopped and the queues drained
+        bool dequeue(size_t workerIndex, queuedMessage& item);
+
+        // pops from the worker's ordered shard first, then from the shared queue
+        bool tryDequeue(size_t workerIndex, queuedMessage& item);
+
+        void workerLoop(size_t workerIndex);
+
     public:
         MqttCallbacks(mqtt::async_client& mqttClient, mqtt::connect_options& connOpts, int numRcvHandlerThreads = std::thread::hardware_concurrency());
         ~MqttCallbacks();
 
+        // dispatch settings apply when the workers start, so they must be set before startWorkers
+        void dispatch(dispatchSettings settings);
+
+        void reconnection(reconnectSettings settings);
+
+        // turned off while the user disconnects on purpose, cancelling any pending attempt
+        void setReconnectEnabled(bool enabled);
+
+        // creates the receive queue and starts the worker threads, does nothing if already started
+        void startWorkers();
+
+        // messages discarded so far by the backpressure policy
+        uint64_t droppedMessages() const;
+
+        // dedicated pool of numThreads threads for the handlers whose settings name it, so they
+        // cannot hold up the shared workers. At most queueCapacity messages wait for it, past
+        // that its handlers are reported with HANDLER_REJECTED. Must be added before those
+        // handlers; throws std::invalid_argument for a taken or reserved name
+        void addExecutor(const std::string& name, int numThreads, size_t queueCapacity = 1024);
+
+        MessagePool& messagePool();
+
+        MqttMetrics& metrics();
+
+        TopicAliases& topicAliases();
+
+        PayloadCompression& compression();
+
+        // keeps the last message of every topic matching topicFilter in lastValues(), subscribed
+        // with qos now if connected and on every (re)connection, handlers or not. Like handlers,
+        // cached filters may be added while messages flow. Caching a filter again with a higher qos
+        // raises it, a lower one is ignored. Throws std::invalid_argument for a malformed filter
+        void cache(std::string topicFilter, int qos = 0);
+
+        LastValueCache& lastValues();
+
+        // takes the broker's Topic Alias Maximum from the CONNACK. Connections started with
+        // this class as listener do it themselves, other connect listeners forward their success here
+        void connectAcknowledged(const mqtt::token& tok);
+
+        // MQTT v5 request: publishes with a response topic and correlation data, the future gets the
+        // response or a RequestTimeout once timeout elapses
+        std::future<mqtt::const_message_ptr> request(const std::string& topic, const std::string& payload, std::chrono::milliseconds timeout, int qos = 0);
+
+        // linear topic/filter comparison, superseded by the handler table indexes for dispatch.
+        // Shared subscription filters match the topics their filter part matches
+        static bool isMqttTopicIncluded(const std::string& topic, const std::string& filter);
+
+        // the filter part of a $share/<group>/<filter> shared subscription, filter itself otherwise.
+        // Throws std::invalid_argument for a malformed shared subscription
+        static std::string_view topicFilterOf(std::string_view filter);
+
         // for class user to add callback for when client is connected
         void onConnect(std::function<void()> onConnectCallback);
 
         // for class user to add callback for when client is disconnected
         void onDisconnect(std::function<void()> onDisconnectCallback);
 
+        // for MqttClient, told of every connection and connection loss ahead of onConnect and onDisconnect
+        void setConnectionStateListener(std::function<void(bool connected)> listener);
+
         void onPublishResult(std::function<void(PublishResult result, int messageId, mqtt::const_message_ptr msg)> onPublishResultCallback);
 
-        // for class user to add callbacks for messages received in specific topics
-        void on(std::string topicFilter, std::function<std::string(std::string topic, std::string payload)> messageHandler);
+        // handler exceptions, deadline overruns and rejections, from the thread running the
+        // handler or from the watchdog. Exceptions on the shared workers are also counted in
+        // the metrics handler errors
+        void onHandlerError(std::function<void(const handlerError& error)> onHandlerErrorCallback);
+
+        // reports a message that never reached paho to onPublishResult, with message id 0.
+        // The message is only built if a callback is set
+        void publishDiscarded(PublishResult result, const std::string& topic, const std::string& payload, int qos, bool retain);
+
+        // reports the aggregate result of a publishBatch to onPublishResult, with message id 0
+        // and a null message
+        void publishBatchCompleted(PublishResult result);
+
+        // for class user to add callbacks for messages received in specific topics, subscribed
+        // with qos now if connected and on every (re)connection. topicFilter may itself be a
+        // $share/<group>/<filter> shared subscription. Handlers may be added while messages flow
+        void on(std::string topicFilter, std::function<std::string(std::string topic, std::string payload)> messageHandler, int qos = 0);
+
+        // same, without copying the topic and the payload for the handler
+        void on(std::string topicFilter, messageViewHandler messageHandler, int qos = 0);
+
+        // same, with subscribe options and share group
+        void on(std::string topicFilter, std::function<std::string(std::string topic, std::string payload)> messageHandler, subscriptionSettings settings);
+        void on(std::string topicFilter, messageViewHandler messageHandler, subscriptionSettings settings);
+
+        // removes the handler of topicFilter (in shareGroup if any), false if there is none.
+        // Messages already handed to a worker or an executor may still reach it. The filter stays
+        // subscribed until the next reconnection, see unsubscribe. Safe while messages flow
+        bool off(const std::string& topicFilter, const std::string& shareGroup = "");
+
+        // off, and unsubscribes topicFilter now if connected unless the cache keeps it
+        bool unsubscribe(const std::string& topicFilter, const std::string& shareGroup = "");
+
+        // true if topicFilter (in shareGroup if any) has a handler, which on would keep
+        bool hasHandler(const std::string& topicFilter, const std::string& shareGroup = "");
+
+        // Typed handler: handler(std::string_view topic, const T& value) gets the payload decoded by
+        // codec, any PayloadCodec, T being its valueType. The payload is decoded once per message
+        // for all the handlers sharing the codec
+        template <typename Codec, typename Handler, typename T = typename Codec::valueType>
+        void on(std::string topicFilter, std::shared_ptr<Codec> codec, Handler handler, subscriptionSettings settings){
+            std::shared_ptr<const PayloadCodec<T>> decoder = std::move(codec);
+            addHandler(topicFilter, [decoder, handler](std::string_view topic, std::string_view payload, DecodedPayloads& decoded, std::string& response){
+                handler(topic, decoded.get(*decoder, payload));
+            }, settings);
+        }
+
+        // same, the R returned by handler is encoded by responseCodec as the MQTT v5 response
+        template <typename Codec, typename ResponseCodec, typename Handler,
+            typename T = typename Codec::valueType, typename R = typename ResponseCodec::valueType>
+        void on(std::string topicFilter, std::shared_ptr<Codec> codec, std::shared_ptr<ResponseCodec> responseCodec, Handler handler, subscriptionSettings settings){
+            static_assert(std::is_convertible_v<std::invoke_result_t<Handler&, std::string_view, const T&>, R>, "handler must return the response type");
+            std::shared_ptr<const PayloadCodec<T>> decoder = std::move(codec);
+            std::shared_ptr<const PayloadCodec<R>> encoder = std::move(responseCodec);
+            addHandler(topicFilter, [decoder, encoder, handler](std::string_view topic, std::string_view payload, DecodedPayloads& decoded, std::string& response){
+                encoder->encode(handler(topic, decoded.get(*decoder, payload)), response);
+            }, settings);
+        }
 
 };
\ No newline at end of file
@@ -1,13 +1,19 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
 #include <string>
 #include <functional>
 #include <vector>
 #include <tuple>
+#include <future>
+#include <unordered_map>
 
 #include <mqtt/async_client.h>
 
 #include "MqttCallbacks.hpp"
+#include "OfflineLog.hpp"
+#include "PublishShaper.hpp"
 
 class MqttClient {
     public:
@@ -18,6 +24,13 @@ class MqttClient {
             std::string clientKeyPassword;
         };
 
+        struct publishEntry {
+            std::string topic;
+            std::string payload;
+            int qos = 0;
+            bool retain = false;
+        };
+
     private:
         std::string _hostAddress;
         int _hostPort;
@@ -29,7 +42,85 @@ class MqttClient {
         std::unique_ptr<mqtt::connect_options> _connectOptionsPtr;
         std::unique_ptr<mqtt::ssl_options> _sslOptionsPtr;
         std::unique_ptr<MqttCallbacks> _callbacksPtr;
+        // outbound stage of publish, when shaping rules are set
+        std::unique_ptr<PublishShaper> _shaperPtr;
+
+        int publishNow(const std::string& topic, const std::string& payload, int qos, bool retain);
+
+        // publish backing store, when set: messages stay on disk until paho completes them
+        std::unique_ptr<OfflineLog> _offlineLogPtr;
+
+        // completes the log record of a publish, whose sequence is the token user context
+        class offlineLogListener : public virtual mqtt::iaction_listener {
+            private:
+                MqttClient& _client;
+                void on_success(const mqtt::token& tok) override;
+                void on_failure(const mqtt::token& tok) override;
+            public:
+                explicit offlineLogListener(MqttClient& client) : _client(client) {}
+        };
+        offlineLogListener _offlineLogListener{*this};
+
+        // publishes assign topic aliases, see topicAliases
+        bool _aliasing = false;
+        // publishes go through PayloadCompression, see compression
+        bool _compressing = false;
+
+        // payload as published: compressed into out, its content encoding added to props, when
+        // compressing and a rule takes it. Done before taking the alias lock
+        std::string_view encodePayload(const std::string& topic, std::string_view payload, std::string& out, mqtt::properties& props);
+        // pool message for topic and an encoded payload, under an alias when aliasing. Callers
+        // hold the alias lock while aliasing, until the message is handed to paho
+        mqtt::message_ptr acquireMessage(const std::string& topic, std::string_view payload, int qos, bool retain, mqtt::properties props, bool& establishesAlias);
+        // encodePayload, then acquireMessage and publish under the alias lock
+        mqtt::delivery_token_ptr send(const std::string& topic, std::string_view payload, int qos, bool retain, void* context, mqtt::iaction_listener& listener);
+
+        // start(listener) connects through this, so the CONNACK is seen by the callbacks too
+        class connectListener : public virtual mqtt::iaction_listener {
+            private:
+                MqttClient& _client;
+                mqtt::iaction_listener* _listener = nullptr;
+                void on_success(const mqtt::token& tok) override;
+                void on_failure(const mqtt::token& tok) override;
+            public:
+                explicit connectListener(MqttClient& client) : _client(client) {}
+                void forwardTo(mqtt::iaction_listener& listener);
+        };
+        connectListener _connectListener{*this};
+
+        // replays the log after each connection, one thread started with the log
+        std::thread _replayThread;
+        std::mutex _replayMutex;
+        std::condition_variable _replayCondition;
+        bool _replayRequested = false;
+        bool _stopReplay = false;
+        // replayed messages paho has not completed yet, at most _replayWindow
+        int64_t _replayInFlight = 0;
+        size_t _replayWindow = 4096;
+
+        // user context of a logged publish, allocated per send and freed on its completion.
+        // A sequence does not fit in a pointer on 32 bit targets
+        struct loggedSend {
+            uint64_t sequence;
+            bool replayed;
+        };
+        // contexts paho has not completed, freed with the client if it never does
+        std::mutex _loggedSendsMutex;
+        std::unordered_map<const loggedSend*, std::unique_ptr<loggedSend>> _loggedSends;
+
+        void replayLoop();
+        void logCompleted(const mqtt::token& tok, bool success);
+        // hands a log record to paho. A refusal while disconnected pauses the log,
+        // one while connected drops the record and reports PUBLISH_FAILURE
+        int sendLogged(uint64_t sequence, bool replayed, const std::string& topic, std::string_view payload, int qos, bool retain);
+
+        // disconnects and waits for paho to complete, failing what it still holds
+        void disconnectNow();
 
+        // publishBatch without the aggregate onPublishResult report, for pools reporting their own
+        friend class MqttClientPool;
+        std::future<MqttCallbacks::PublishResult> submitBatch(const std::vector<publishEntry>& entries,
+            std::function<void(MqttCallbacks::PublishResult result, size_t failed)> onComplete);
 
     public:
         MqttClient(std::string hostAddress, std::string clientId);
@@ -40,13 +131,98 @@ class MqttClient {
         MqttClient(std::string hostAddress, int port, std::string clientId, sslSettings sslParams);
         MqttClient(std::string hostAddress, std::string clientId, int mqttVersion, sslSettings sslParams);
         MqttClient(std::string hostAddress, int port, std::string clientId, int mqttVersion, std::string persistDir, sslSettings sslParams);
+        ~MqttClient();
         void start();
+        // same, reporting the outcome of the connection attempt to listener
+        void start(mqtt::iaction_listener& listener);
         void finish();
-        int publish(std::string topic, std::string payload, int qos, bool retain);
-        void on(std::string topicFilter, std::function<std::string(std::string topic, std::string payload)> messageHandler);
+        // goes through the shaping rules if set, returning 0 for messages held, batched or dropped
+        int publish(const std::string& topic, const std::string& payload, int qos, bool retain);
+        // same, listener is told once the message is delivered (PUBACK/PUBCOMP for QoS 1/2, sent for QoS 0)
+        int publish(const std::string& topic, const std::string& payload, int qos, bool retain, mqtt::iaction_listener& listener);
+        // subscribes now, listener is told once the broker acknowledged. Filters registered with on()
+        // are subscribed on every (re)connection without this
+        void subscribe(const std::string& topicFilter, int qos, mqtt::iaction_listener& listener);
+        // Builds every message first, then submits them in one pass. The future (and onComplete, if set)
+        // resolves once the whole batch completed, with PUBLISH_FAILURE if any message failed.
+        // onPublishResult reports each message, then the batch once with message id 0 and a null message
+        std::future<MqttCallbacks::PublishResult> publishBatch(const std::vector<publishEntry>& entries,
+            std::function<void(MqttCallbacks::PublishResult result, size_t failed)> onComplete = nullptr);
+        // handlers are subscribed with qos, kept across reconnections
+        void on(std::string topicFilter, std::function<std::string(std::string topic, std::string payload)> messageHandler, int qos = 0);
+        // zero-copy variant, see MqttCallbacks::messageViewHandler
+        void on(std::string topicFilter, MqttCallbacks::messageViewHandler messageHandler, int qos = 0);
+        // MQTT v5 subscribe options and shared subscriptions, see MqttCallbacks::subscriptionSettings
+        void on(std::string topicFilter, std::function<std::string(std::string topic, std::string payload)> messageHandler, MqttCallbacks::subscriptionSettings settings);
+        void on(std::string topicFilter, MqttCallbacks::messageViewHandler messageHandler, MqttCallbacks::subscriptionSettings settings);
+        // typed handlers, handler(std::string_view topic, const T& value), see MqttCallbacks::on
+        template <typename Codec, typename Handler, typename = typename Codec::valueType>
+        void on(std::string topicFilter, std::shared_ptr<Codec> codec, Handler handler, MqttCallbacks::subscriptionSettings settings = MqttCallbacks::subscriptionSettings()){
+            _callbacksPtr->on(topicFilter, std::move(codec), std::move(handler), settings);
+        }
+        template <typename Codec, typename ResponseCodec, typename Handler,
+            typename = typename Codec::valueType, typename = typename ResponseCodec::valueType>
+        void on(std::string topicFilter, std::shared_ptr<Codec> codec, std::shared_ptr<ResponseCodec> responseCodec, Handler handler, MqttCallbacks::subscriptionSettings settings = MqttCallbacks::subscriptionSettings()){
+            _callbacksPtr->on(topicFilter, std::move(codec), std::move(responseCodec), std::move(handler), settings);
+        }
+        // removes a handler, see MqttCallbacks::off and MqttCallbacks::unsubscribe
+        bool off(const std::string& topicFilter, const std::string& shareGroup = "");
+        bool unsubscribe(const std::string& topicFilter, const std::string& shareGroup = "");
+        bool hasHandler(const std::string& topicFilter, const std::string& shareGroup = "");
         void onConnect(std::function<void()> onConnectCallback);
         void onDisconnect(std::function<void()> onDisconnectCallback);
+        // dispatch and publish instrumentation, off until metrics().enable(true)
+        MqttMetrics& metrics();
+        // allocation counters of the pool outgoing messages are drawn from
+        MessagePool::counters messagePoolCounters();
         void onPublishResult(std::function<void(MqttCallbacks::PublishResult result, int messageId, mqtt::const_message_ptr msg)> onPublishResultCallback);
+        // handler exceptions, deadline overruns and rejections, see MqttCallbacks::handlerError
+        void onHandlerError(std::function<void(const MqttCallbacks::handlerError& error)> onHandlerErrorCallback);
+        // MQTT v5 request/response, see MqttCallbacks::request
+        std::future<mqtt::const_message_ptr> request(const std::string& topic, const std::string& payload, std::chrono::milliseconds timeout, int qos = 0);
+        // receive queue and worker pool settings, must be set before start
+        void dispatch(MqttCallbacks::dispatchSettings settings);
+        // dedicated handler pool, named in the subscriptionSettings of the handlers it runs.
+        // Must be added before those handlers
+        void addExecutor(const std::string& name, int numThreads, size_t queueCapacity = 1024);
+        // coalescing, rate limiting and batching of publish by topic prefix, see PublishShaper.
+        // Must be set before publishing; publishBatch and request are not shaped
+        void shaping(std::vector<PublishShaper::rule> rules);
+        PublishShaper::counters shapingCounters();
+        // Keeps every publish in a memory-mapped OfflineLog until paho completes it, in place
+        // of paho's in-memory buffer: while disconnected publish only appends, and on each
+        // connection the log is replayed in order, at most replayWindow messages in flight,
+        // before publishes go straight out again. Delivery is at least once across reconnections
+        // and restarts. A publish paho refuses while connected is dropped and reported as
+        // PUBLISH_FAILURE. Must be set before start; publishBatch and request are not logged
+        void offlineLog(OfflineLog::settings settings, size_t replayWindow = 4096);
+        OfflineLog::counters offlineLogCounters();
+        // MQTT v5 topic aliases, see TopicAliases: publishes reuse an alias per recent topic
+        // and the broker may alias what it sends when settings.maxInbound is set. Must be set
+        // before start. onPublishResult reports aliased messages with an empty topic
+        void topicAliases(TopicAliases::settings settings);
+        TopicAliases::counters topicAliasCounters();
+        // MQTT v5 payload compression by topic prefix, see PayloadCompression. Applies to publish,
+        // publishBatch and the offline log (which keeps payloads as given); request and handler
+        // responses are sent as they are. Once compression or a dictionary is set, compressed messages
+        // received are inflated before dispatch, those failing reported with HANDLER_INFLATE_FAILED.
+        // Dictionaries and settings must be set before start
+        void compression(PayloadCompression::settings settings);
+        void addCompressionDictionary(uint32_t id, std::string content);
+        PayloadCompression::counters compressionCounters();
+        // Last-value cache, see LastValueCache: keeps the last message of every topic matching
+        // topicFilter, subscribed with qos. latest and snapshot never lock nor copy payloads and
+        // may be called from any thread. Filters are best added before start
+        void cache(std::string topicFilter, int qos = 0);
+        // bytes the cache keeps before evicting the least recently updated topics, 64 MiB by default
+        void cacheBudget(size_t budgetBytes);
+        // last message of topic, null if none
+        mqtt::const_message_ptr latest(std::string_view topic) const;
+        // last message of every cached topic matching topicFilter
+        std::vector<mqtt::const_message_ptr> snapshot(const std::string& topicFilter) const;
+        LastValueCache::counters cacheCounters() const;
+        // backoff of the reconnect scheduler and resubscription batching
+        void reconnection(MqttCallbacks::reconnectSettings settings);
         void lastWill(std::string topic, std::string payload, int qos, bool retain);
         bool isConnected();
 };
\ No newline at end of file
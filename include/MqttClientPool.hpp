@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "MqttClient.hpp"
+
+// N MqttClients, i.e. N connections and N paho send threads, behind the MqttClient surface.
+// Client ids are derived from the given one as "<clientId>-0" to "<clientId>-<N-1>".
+// Publishes are sharded by topic hash, so every message of a topic goes through the same
+// connection and keeps its order; topic filters are spread the same way, each subscribed
+// on one connection only. Message ids are per connection, so two shards can report the same id.
+class MqttClientPool {
+    private:
+        std::vector<std::unique_ptr<MqttClient>> _clients;
+
+        // connections up since start, onConnect fires when all of them are
+        std::atomic<size_t> _connectedClients{0};
+        std::function<void()> _onConnectCallback = nullptr;
+        std::function<void()> _onDisconnectCallback = nullptr;
+
+        size_t shardOf(const std::string& topic) const;
+
+        void watchConnections();
+
+    public:
+        MqttClientPool(std::string hostAddress, int port, std::string clientId, size_t connections, int mqttVersion = MQTTVERSION_3_1_1);
+        MqttClientPool(std::string hostAddress, int port, std::string clientId, size_t connections, int mqttVersion, MqttClient::sslSettings sslParams);
+
+        void start();
+        void finish();
+        int publish(const std::string& topic, const std::string& payload, int qos, bool retain);
+        // splits the entries by shard into one batch per connection, resolved once all are, and
+        // reported to onPublishResult once for the whole batch
+        std::future<MqttCallbacks::PublishResult> publishBatch(const std::vector<MqttClient::publishEntry>& entries,
+            std::function<void(MqttCallbacks::PublishResult result, size_t failed)> onComplete = nullptr);
+        void on(std::string topicFilter, std::function<std::string(std::string topic, std::string payload)> messageHandler, int qos = 0);
+        void on(std::string topicFilter, MqttCallbacks::messageViewHandler messageHandler, int qos = 0);
+        // subscribe options and share group, see MqttCallbacks::subscriptionSettings
+        void on(std::string topicFilter, std::function<std::string(std::string topic, std::string payload)> messageHandler, MqttCallbacks::subscriptionSettings settings);
+        void on(std::string topicFilter, MqttCallbacks::messageViewHandler messageHandler, MqttCallbacks::subscriptionSettings settings);
+        template <typename Codec, typename Handler, typename = typename Codec::valueType>
+        void on(std::string topicFilter, std::shared_ptr<Codec> codec, Handler handler, MqttCallbacks::subscriptionSettings settings = MqttCallbacks::subscriptionSettings()){
+            _clients[shardOf(topicFilter)]->on(topicFilter, std::move(codec), std::move(handler), settings);
+        }
+        template <typename Codec, typename ResponseCodec, typename Handler,
+            typename = typename Codec::valueType, typename = typename ResponseCodec::valueType>
+        void on(std::string topicFilter, std::shared_ptr<Codec> codec, std::shared_ptr<ResponseCodec> responseCodec, Handler handler, MqttCallbacks::subscriptionSettings settings = MqttCallbacks::subscriptionSettings()){
+            _clients[shardOf(topicFilter)]->on(topicFilter, std::move(codec), std::move(responseCodec), std::move(handler), settings);
+        }
+        // on the connection the filter was added to, see MqttClient::off
+        bool off(const std::string& topicFilter, const std::string& shareGroup = "");
+        bool unsubscribe(const std::string& topicFilter, const std::string& shareGroup = "");
+        // called once every connection is up, after start and after reconnections
+        void onConnect(std::function<void()> onConnectCallback);
+        // called whenever one of the connections is lost
+        void onDisconnect(std::function<void()> onDisconnectCallback);
+        void onPublishResult(std::function<void(MqttCallbacks::PublishResult result, int messageId, mqtt::const_message_ptr msg)> onPublishResultCallback);
+        void onHandlerError(std::function<void(const MqttCallbacks::handlerError& error)> onHandlerErrorCallback);
+        // goes through the shard of topic, the response comes back on the same connection
+        std::future<mqtt::const_message_ptr> request(const std::string& topic, const std::string& payload, std::chrono::milliseconds timeout, int qos = 0);
+        // applied to every connection, so the worker count is per connection
+        void dispatch(MqttCallbacks::dispatchSettings settings);
+        // added to every connection, so the thread count is per connection
+        void addExecutor(const std::string& name, int numThreads, size_t queueCapacity = 1024);
+        void reconnection(MqttCallbacks::reconnectSettings settings);
+        // set on the first connection only: one crash publishes it once, and it stands for the
+        // pool as a whole, not for the loss of any other single connection
+        void lastWill(std::string topic, std::string payload, int qos, bool retain);
+        // true when every connection is up
+        bool isConnected();
+
+        size_t size() const;
+        // the connection at index, for its metrics and counters
+        MqttClient& client(size_t index);
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "LatencyHistogram.hpp"
+
+// Instrumentation of the dispatch and publish paths: counters, queue depth, time from
+// enqueue to handler, handler run time per worker and per topic filter, and publish to
+// acknowledgement time per message id. Everything is off until enable(true); while off
+// every instrumentation point costs one relaxed atomic load and takes no timestamps.
+class MqttMetrics {
+    public:
+        // handler time histogram of one topic filter, allocated on the first record so
+        // idle filters and disabled metrics only cost this object
+        class filterStats {
+            private:
+                std::string _filter;
+                std::atomic<LatencyHistogram*> _handlerTime{nullptr};
+            public:
+                explicit filterStats(std::string filter);
+                ~filterStats();
+                void record(uint64_t nanoseconds);
+                const std::string& filter() const;
+                const LatencyHistogram* handlerTime() const;
+        };
+
+        struct workerSnapshot {
+            uint64_t handled = 0;
+            uint64_t handlerErrors = 0;
+            LatencyHistogram::summary handlerTime;
+        };
+
+        // all durations in nanoseconds
+        struct snapshot {
+            uint64_t received = 0;
+            uint64_t dropped = 0;
+            uint64_t handled = 0;
+            uint64_t handlerErrors = 0;
+            uint64_t published = 0;
+            uint64_t publishFailures = 0;
+            uint64_t actionFailures = 0;
+            size_t queueDepth = 0;
+            size_t pendingRequests = 0;
+            LatencyHistogram::summary queueWait;
+            LatencyHistogram::summary publishRoundTrip;
+            std::vector<workerSnapshot> workers;
+            std::vector<std::pair<std::string, LatencyHistogram::summary>> filters;
+        };
+
+    private:
+        // written by a single worker thread, on its own cache line
+        struct alignas(64) workerStats {
+            std::atomic<uint64_t> handled{0};
+            std::atomic<uint64_t> handlerErrors{0};
+            LatencyHistogram handlerTime;
+            LatencyHistogram queueWait;
+        };
+
+        std::atomic<bool> _enabled{false};
+        std::string _clientId;
+
+        // received is only written by the paho callback thread
+        alignas(64) std::atomic<uint64_t> _received{0};
+        alignas(64) std::atomic<uint64_t> _published{0};
+        std::atomic<uint64_t> _publishFailures{0};
+        std::atomic<uint64_t> _actionFailures{0};
+
+        // set once by the dispatcher, read by snapshots from any thread
+        std::mutex _workersMutex;
+        std::vector<std::unique_ptr<workerStats>> _workers;
+
+        // stats by filter, shared by the handlers of that filter and freed with the last of them.
+        // Entries of freed stats are pruned by snapshots, and by registrations once they may
+        // outnumber the live ones
+        std::mutex _filtersMutex;
+        std::unordered_map<std::string, std::weak_ptr<filterStats>> _filters;
+        size_t _filtersPruneAt = 64;
+
+        // publishes waiting for their acknowledgement, and acknowledgements that won the race
+        // against the publishing thread learning its message id. Both are keyed by paho's reused
+        // message ids: emptied whenever the metrics are switched, and acknowledgements of publishes
+        // never tracked (requests, shaped frames) are dropped once too old to be such a race
+        std::mutex _publishesMutex;
+        std::unordered_map<int, int64_t> _publishStarts;
+        std::unordered_map<int, int64_t> _earlyAcks;
+        size_t _earlyAcksSweepAt = 1024;
+        LatencyHistogram _publishRoundTrip;
+
+        // fills the gauges owned by the dispatcher: queue depth, dropped messages, pending requests.
+        // Called under _gaugesMutex, so clearing them waits for a snapshot taking them
+        std::mutex _gaugesMutex;
+        std::function<void(snapshot& current)> _gauges = nullptr;
+
+        std::thread _dumpThread;
+        std::mutex _dumpMutex;
+        std::condition_variable _dumpCondition;
+        bool _stopDump = false;
+
+    public:
+        explicit MqttMetrics(std::string clientId);
+        ~MqttMetrics();
+
+        static int64_t now();
+
+        // switching forgets the publishes waiting for their acknowledgement
+        void enable(bool enabled);
+        bool enabled() const {
+            return _enabled.load(std::memory_order_relaxed);
+        }
+
+        // called by the dispatcher before its workers start
+        void setWorkers(size_t numWorkers);
+        // null clears them, once no snapshot is still reading them
+        void setGauges(std::function<void(snapshot& current)> gauges);
+
+        // stats of a topic filter, the same object for every holder of that filter. Reported
+        // while someone holds it
+        std::shared_ptr<filterStats> registerFilter(const std::string& filter);
+
+        void messageReceived();
+        void messageHandled(size_t workerIndex, int64_t enqueuedAt, int64_t startedAt, int64_t finishedAt);
+        void handlerError(size_t workerIndex);
+        void publishSent(int messageId, int64_t startedAt);
+        void publishAcknowledged(int messageId, bool success);
+        void actionFailed();
+
+        snapshot getSnapshot();
+
+        // Prometheus text exposition format
+        std::string prometheus();
+
+        // calls sink with the Prometheus text every interval, until the metrics are destroyed
+        void dumpEvery(std::chrono::milliseconds interval, std::function<void(const std::string& text)> sink);
+};
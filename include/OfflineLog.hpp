@@ -0,0 +1,165 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Append-only log of outgoing messages in memory-mapped segment files, holding what was
+// published while disconnected or is not acknowledged yet, bounded by bytes on disk.
+// Appends are a copy into the mapping; a sync thread flushes everything appended since
+// its last pass with one msync (group commit). Records are read back in order for
+// replay, and a segment is deleted once all of its records are acknowledged.
+//
+// Segment layout: 16 byte header (magic, version, first sequence) then records of
+// u32 body length, u32 crc32 of the body, and the body: u64 sequence, u8 qos, u8 retain,
+// u16 topic length, topic, payload. Integers are in host order, the log is not meant to
+// move between machines. A record with a bad crc ends its segment on recovery.
+class OfflineLog {
+    public:
+        // what append does when a new segment would exceed maxBytes
+        enum FullPolicy {
+            // refuse the arriving message
+            FULL_REJECT = 0,
+            // delete the oldest segment, acknowledged or not
+            FULL_DROP_OLDEST = 1
+        };
+
+        struct settings {
+            // created if missing, the log of a previous run found there is recovered
+            std::string directory;
+            size_t segmentBytes = 64 << 20;
+            // at least two segments
+            uint64_t maxBytes = 1ull << 30;
+            // appended records reach the disk at most this long after the append, in one
+            // msync for all of them. 0 leaves writing back to the OS
+            std::chrono::milliseconds syncInterval{10};
+            FullPolicy full = FULL_REJECT;
+        };
+
+        struct appendResult {
+            // 0 when the log is full and the message was refused
+            uint64_t sequence = 0;
+            // the log is caught up and not paused: the caller sends the message now, otherwise
+            // it is handed out later by read
+            bool send = false;
+        };
+
+        // views into the mapping, valid until the consumer returns
+        struct record {
+            uint64_t sequence;
+            std::string_view topic;
+            std::string_view payload;
+            int qos;
+            bool retain;
+        };
+
+        struct counters {
+            uint64_t appended = 0;
+            uint64_t acknowledged = 0;
+            uint64_t rejected = 0;
+            // unacknowledged records lost with their segment under FULL_DROP_OLDEST
+            uint64_t dropped = 0;
+            uint64_t syncs = 0;
+            // records not acknowledged yet
+            uint64_t pending = 0;
+            uint64_t bytesOnDisk = 0;
+        };
+
+    private:
+        struct segment {
+            uint64_t id = 0;
+            std::string path;
+            int fd = -1;
+            char* data = nullptr;
+            size_t size = 0;
+            uint64_t firstSequence = 0;
+            // end of the records written so far
+            size_t writeOffset = 0;
+            // end of what the sync thread flushed
+            size_t syncedOffset = 0;
+            std::vector<bool> acked;
+            size_t pending = 0;
+            // lowest record index that may still be unacknowledged
+            size_t firstPending = 0;
+            // unlinks the file once the last reader lets go of it
+            bool remove = false;
+            ~segment();
+        };
+
+        settings _settings;
+        int _headFd = -1;
+
+        std::mutex _mutex;
+        std::deque<std::shared_ptr<segment>> _segments;
+        uint64_t _nextSegmentId = 0;
+        uint64_t _nextSequence = 1;
+        // read position: segment id and offset of the next record to hand out
+        uint64_t _cursorSegment = 0;
+        size_t _cursorOffset = 0;
+        // appends are handed out directly, set when read reaches the end and not paused
+        bool _caughtUp = false;
+        counters _counters;
+
+        // one flush at a time, and the watermark it last wrote to the head file
+        std::mutex _flushMutex;
+        uint64_t _syncedHead = 0;
+
+        std::mutex _syncMutex;
+        std::thread _syncThread;
+        std::condition_variable _syncCondition;
+        bool _stopSync = false;
+
+        static constexpr size_t headerBytes = 16;
+        static constexpr size_t recordHeaderBytes = 8;
+        static constexpr size_t bodyHeaderBytes = 12;
+
+        std::shared_ptr<segment> openSegment(const std::string& path, uint64_t id);
+        std::shared_ptr<segment> createSegment(uint64_t firstSequence);
+        // walks the records of a recovered segment up to the first invalid one
+        void recover(segment& seg, uint64_t headSequence);
+        // makes room for bytes more in the active segment, false if the log is full
+        bool reserve(size_t bytes);
+        // deletes fully acknowledged segments from the front, never the active one
+        void trim();
+        uint64_t headSequence();
+        void syncLoop();
+
+    public:
+        // throws std::invalid_argument for bad settings and std::runtime_error when the
+        // directory or a segment cannot be opened
+        explicit OfflineLog(settings logSettings);
+        // flushes the segments and stops the sync thread
+        ~OfflineLog();
+
+        OfflineLog(const OfflineLog&) = delete;
+        OfflineLog& operator=(const OfflineLog&) = delete;
+
+        // throws std::invalid_argument for a message larger than a segment
+        appendResult append(std::string_view topic, std::string_view payload, int qos, bool retain);
+
+        void acknowledge(uint64_t sequence);
+
+        // hands up to maxRecords unacknowledged records after the read position to consumer,
+        // in order, and returns how many. Returning 0 means the log caught up: from then on
+        // appends are sent directly until pause
+        size_t read(size_t maxRecords, const std::function<void(const record&)>& consumer);
+
+        // appends are kept for read, for when the connection is lost
+        void pause();
+
+        // read starts over from the oldest unacknowledged record, for when the connection is back
+        void rewind();
+
+        // flushes everything appended so far and the acknowledged watermark, blocking
+        void sync();
+
+        counters getCounters();
+};
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// Lets threads sleep until some condition they polled for may have changed
+// (an event count). Notifiers only touch the mutex and the condition variable
+// when somebody is actually parked, so the fast path costs two atomic operations
+// and no syscall.
+//
+// Waiter side: epoch = prepareWait(), re-check the condition, then cancelWait()
+// if it became true or commitWait(epoch) to sleep.
+class Parker {
+    private:
+        std::atomic<uint64_t> _epoch{0};
+        std::atomic<int> _waiters{0};
+        std::mutex _mutex;
+        std::condition_variable _conditionVariable;
+
+    public:
+        uint64_t prepareWait();
+        void cancelWait();
+        void commitWait(uint64_t epoch);
+
+        // wake one parked thread, returns false if nobody was parked
+        bool notifyOne();
+        // wake every parked thread
+        void notifyAll();
+};
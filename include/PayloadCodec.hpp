@@ -0,0 +1,49 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Turns payloads into values of T and back, for the typed handlers of MqttCallbacks::on.
+// decode may keep views into the payload: the value is only used while the message is
+// being dispatched. Malformed payloads throw, which counts as a handler error.
+template <typename T>
+class PayloadCodec {
+    public:
+        using valueType = T;
+
+        virtual ~PayloadCodec() = default;
+
+        virtual T decode(std::string_view payload) const = 0;
+
+        // appends the encoded value to out
+        virtual void encode(const T& value, std::string& out) const = 0;
+};
+
+// Values decoded from the payload of the message being dispatched, one per codec, so every
+// matching handler sharing a codec gets the result of a single decode. Each worker keeps
+// one and clears it between messages.
+class DecodedPayloads {
+    private:
+        std::vector<std::pair<const void*, std::shared_ptr<const void>>> _values;
+
+    public:
+        template <typename T>
+        const T& get(const PayloadCodec<T>& codec, std::string_view payload){
+            for(const auto& value : _values){
+                if(value.first == &codec){
+                    return *static_cast<const T*>(value.second.get());
+                }
+            }
+            auto decoded = std::make_shared<const T>(codec.decode(payload));
+            const T& result = *decoded;
+            _values.emplace_back(&codec, std::move(decoded));
+            return result;
+        }
+
+        void clear(){
+            _values.clear();
+        }
+};
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <mqtt/async_client.h>
+
+// MQTT v5 payload compression. Outgoing payloads are compressed by the rule with the longest
+// topic prefix matching their topic, and marked with a "content-encoding" user property of
+// "zstd" or "lz4", followed by ":<id>" when a shared dictionary was used. Once configured or
+// given a dictionary, incoming payloads carrying the property are inflated before dispatch,
+// whatever the rules; those marked with an encoding not built in are dispatched as they are.
+// LZ4 payloads are a block prefixed with its inflated size (u32 little endian), zstd payloads
+// a single frame. Each codec is only there if built with MQTT_CLIENT_WITH_ZSTD or
+// MQTT_CLIENT_WITH_LZ4.
+class PayloadCompression {
+    public:
+        enum Algorithm {
+            COMPRESSION_NONE = 0,
+            COMPRESSION_LZ4 = 1,
+            COMPRESSION_ZSTD = 2
+        };
+
+        struct rule {
+            std::string topicPrefix;
+            Algorithm algorithm = COMPRESSION_ZSTD;
+            // zstd level or LZ4 acceleration, 0 for the library default
+            int level = 0;
+            // smaller payloads are sent as they are
+            size_t minBytes = 256;
+            // added with addDictionary, 0 for none
+            uint32_t dictionary = 0;
+        };
+
+        struct settings {
+            std::vector<rule> rules;
+            // incoming payloads inflating past this are dropped
+            size_t maxInflatedBytes = 64 << 20;
+        };
+
+        struct counters {
+            uint64_t compressed = 0;
+            // below the minBytes of their rule
+            uint64_t skippedSmall = 0;
+            // not smaller once compressed, sent as they were
+            uint64_t incompressible = 0;
+            // payload bytes before and after compression
+            uint64_t bytesIn = 0;
+            uint64_t bytesOut = 0;
+            uint64_t inflated = 0;
+            // unknown dictionary, corrupt or oversized payloads
+            uint64_t inflateFailures = 0;
+            // marked with an encoding not built in, dispatched as they were
+            uint64_t passedThrough = 0;
+        };
+
+    private:
+        struct dictionary;
+
+        struct compiledRule {
+            rule settings;
+            const dictionary* shared = nullptr;
+            // the property value marking its payloads
+            std::string encoding;
+            // digested zstd dictionary at the rule's level
+            std::shared_ptr<void> zstdDictionary;
+        };
+
+        settings _settings;
+        std::vector<compiledRule> _rules;
+        std::unordered_map<uint32_t, std::unique_ptr<dictionary>> _dictionaries;
+        bool _inflates = false;
+
+        std::atomic<uint64_t> _compressed{0};
+        std::atomic<uint64_t> _skippedSmall{0};
+        std::atomic<uint64_t> _incompressible{0};
+        std::atomic<uint64_t> _bytesIn{0};
+        std::atomic<uint64_t> _bytesOut{0};
+        std::atomic<uint64_t> _inflated{0};
+        std::atomic<uint64_t> _inflateFailures{0};
+        std::atomic<uint64_t> _passedThrough{0};
+
+        const compiledRule* findRule(const std::string& topic) const;
+
+        // inflates payload as given by encoding into out, false if it cannot
+        bool inflate(std::string_view encoding, std::string_view payload, std::string& out) const;
+
+    public:
+        PayloadCompression();
+        ~PayloadCompression();
+
+        PayloadCompression(const PayloadCompression&) = delete;
+        PayloadCompression& operator=(const PayloadCompression&) = delete;
+
+        // whether algorithm was built in
+        static bool available(Algorithm algorithm);
+
+        // shared dictionary, for the rules naming it and for inflating what peers compressed with
+        // it. Must be added before start and before the rules using it. Throws std::invalid_argument
+        // for id 0 or a taken id
+        void addDictionary(uint32_t id, std::string content);
+
+        // must be set before start. Throws std::invalid_argument for an algorithm not built in
+        // or an unknown dictionary
+        void configure(settings newSettings);
+
+        // whether some rule may compress
+        bool compresses() const;
+
+        // whether incoming payloads are inflated, once configure or addDictionary was called
+        bool inflates() const;
+
+        // compresses payload into out and adds the marking property to props if a rule says so,
+        // false if payload is to be sent as it is
+        bool compress(const std::string& topic, std::string_view payload, std::string& out, mqtt::properties& props);
+
+        // inflates a marked payload into out, props getting the other properties of msg.
+        // False if msg is not compressed or its encoding is not built in; throws
+        // std::runtime_error if it cannot be inflated
+        bool decompress(const mqtt::message& msg, std::string& out, mqtt::properties& props);
+
+        counters getCounters() const;
+};
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "PayloadCodec.hpp"
+
+// Codec for a protobuf generated Message type. Header only and only instantiated by users,
+// so the library itself does not depend on protobuf.
+template <typename Message>
+class ProtobufCodec: public PayloadCodec<Message> {
+    public:
+        Message decode(std::string_view payload) const override {
+            Message message;
+            if(!message.ParseFromArray(payload.data(), static_cast<int>(payload.size()))){
+                throw std::invalid_argument("Malformed protobuf payload");
+            }
+            return message;
+        }
+
+        void encode(const Message& value, std::string& out) const override {
+            if(!value.AppendToString(&out)){
+                throw std::invalid_argument("Protobuf message is missing required fields");
+            }
+        }
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+
+#include <mqtt/async_client.h>
+
+#include "MqttCallbacks.hpp"
+
+// Action listener shared by every message of a batch submitted with MqttClient::publishBatch.
+// It counts completions down and resolves one future (and an optional callback) for the
+// whole batch: PUBLISH_SUCCESS when every message was delivered, PUBLISH_FAILURE otherwise.
+// The batch keeps itself alive until its last message completes.
+class PublishBatch: public virtual mqtt::iaction_listener
+{
+    private:
+        std::atomic<size_t> _pending;
+        std::atomic<size_t> _failed{0};
+        std::promise<MqttCallbacks::PublishResult> _promise;
+        std::function<void(MqttCallbacks::PublishResult result, size_t failed)> _onComplete;
+        std::shared_ptr<PublishBatch> _self;
+
+        void complete(bool success);
+
+        void on_failure(const mqtt::token& tok) override;
+        void on_success(const mqtt::token& tok) override;
+
+    public:
+        PublishBatch(size_t size, std::function<void(MqttCallbacks::PublishResult result, size_t failed)> onComplete);
+
+        static std::shared_ptr<PublishBatch> create(size_t size, std::function<void(MqttCallbacks::PublishResult result, size_t failed)> onComplete = nullptr);
+
+        std::future<MqttCallbacks::PublishResult> getFuture();
+
+        // for messages the client refused to take, which will never complete
+        void submitFailed();
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "MqttCallbacks.hpp"
+
+// Optional outbound stage in front of MqttClient::publish. Topics are matched against rules
+// by longest prefix, topics matching no rule are sent as before. A rule can
+//  - coalesce: the first publish of a topic opens a window, later ones replace its payload
+//    and only the latest is sent when the window closes (last value wins);
+//  - rate limit: a token bucket shared by every topic of the rule, messages arriving with
+//    an empty bucket are dropped;
+//  - batch: messages are appended to one framed message published on batchTopic once it
+//    is full or its window closes, see frame/unframe for the format.
+// The stages apply in that order. Replaced and dropped messages are reported as
+// PUBLISH_COALESCED and PUBLISH_DROPPED.
+class PublishShaper {
+    public:
+        struct rule {
+            std::string topicPrefix;
+            // 0 disables coalescing
+            std::chrono::milliseconds coalesceWindow{0};
+            // messages per second and bucket size, 0 disables rate limiting
+            double rate = 0;
+            double burst = 1;
+            // empty disables batching
+            std::string batchTopic;
+            size_t batchMaxMessages = 64;
+            size_t batchMaxBytes = 65536;
+            std::chrono::milliseconds batchWindow{10};
+        };
+
+        struct counters {
+            uint64_t coalesced = 0;
+            uint64_t dropped = 0;
+            uint64_t batched = 0;
+            uint64_t frames = 0;
+        };
+
+        // sends a message now, returns its message id
+        using sender = std::function<int(const std::string& topic, const std::string& payload, int qos, bool retain)>;
+        // reports a message that will not be sent
+        using reporter = std::function<void(MqttCallbacks::PublishResult result, const std::string& topic, const std::string& payload, int qos, bool retain)>;
+
+    private:
+        struct ruleState {
+            rule settings;
+            double tokens = 0;
+            std::chrono::steady_clock::time_point refilledAt;
+            // frame being filled for batching
+            std::string frame;
+            size_t frameMessages = 0;
+            int frameQos = 0;
+            uint64_t frameGeneration = 0;
+        };
+
+        struct pendingPublish {
+            std::string topic;
+            std::string payload;
+            int qos = 0;
+            bool retain = false;
+            size_t ruleIndex = 0;
+            uint64_t generation = 0;
+        };
+
+        // closing coalesce window (topic set) or batch window (topic empty). Timers are not
+        // removed when their message or frame leaves early, generation tells them apart
+        struct timer {
+            std::chrono::steady_clock::time_point at;
+            size_t ruleIndex;
+            std::string topic;
+            uint64_t generation;
+            bool operator>(const timer& other) const { return at > other.at; }
+        };
+
+        enum admission {
+            ADMIT_SEND = 0,
+            ADMIT_HELD = 1,
+            ADMIT_DROPPED = 2
+        };
+
+        sender _send;
+        reporter _report;
+
+        std::mutex _mutex;
+        std::vector<ruleState> _rules;
+        std::unordered_map<std::string, pendingPublish> _pending;
+        uint64_t _nextGeneration = 1;
+        std::priority_queue<timer, std::vector<timer>, std::greater<timer>> _timers;
+        counters _counters;
+
+        std::thread _timerThread;
+        std::condition_variable _timerCondition;
+        bool _stop = false;
+
+        // index of the rule with the longest prefix of topic, -1 if none
+        int ruleOf(std::string_view topic) const;
+
+        void addTimer(std::chrono::steady_clock::time_point at, size_t ruleIndex, std::string topic, uint64_t generation);
+
+        // rate limit and batching stages, called with the lock held. Full frames are moved
+        // to frames, ADMIT_SEND means the caller sends the message itself after unlocking
+        admission admit(const pendingPublish& message, std::vector<pendingPublish>& frames);
+
+        // moves the rule's frame into frames for sending
+        void takeFrame(size_t ruleIndex, std::vector<pendingPublish>& frames);
+
+        // sends from the timer thread, flush, or frames completed by another caller's publish,
+        // where a publish refused by paho or the offline log is reported as PUBLISH_FAILURE
+        // instead of thrown
+        void sendReporting(const pendingPublish& message);
+
+        void timerLoop();
+
+    public:
+        PublishShaper(std::vector<rule> rules, sender send, reporter report);
+        ~PublishShaper();
+
+        PublishShaper(const PublishShaper&) = delete;
+        PublishShaper& operator=(const PublishShaper&) = delete;
+
+        // returns the message id when sent right away, 0 when held, batched or dropped
+        int publish(const std::string& topic, const std::string& payload, int qos, bool retain);
+
+        // sends every held message and partial frame now
+        void flush();
+
+        counters getCounters();
+
+        // appends one entry to a frame: 2 byte topic length, topic, 4 byte payload length,
+        // payload, lengths big-endian
+        static void frame(std::string& out, std::string_view topic, std::string_view payload);
+
+        // calls entry for each entry of a frame, returns false if the frame is malformed
+        static bool unframe(std::string_view frame, const std::function<void(std::string_view topic, std::string_view payload)>& entry);
+};
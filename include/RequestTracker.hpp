@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <mqtt/async_client.h>
+
+// Set on the future of a request whose response did not arrive in time
+class RequestTimeout: public std::runtime_error
+{
+    public:
+        RequestTimeout() : std::runtime_error("MQTT request timed out") {}
+};
+
+// Client side of MQTT v5 request/response: hands out correlation ids, matches responses
+// back to their pending request through a hash map, and expires requests with a hashed
+// timer wheel, so adding, completing and expiring a request are all O(1) no matter how
+// many are in flight.
+class RequestTracker {
+    private:
+        struct pendingRequest {
+            std::promise<mqtt::const_message_ptr> promise;
+            uint64_t expiryTick;
+        };
+
+        const std::chrono::milliseconds _tickPeriod;
+
+        std::mutex _mutex;
+        std::unordered_map<uint64_t, pendingRequest> _pending;
+        // each slot lists the ids expiring on ticks congruent to it, completed ids are skipped lazily
+        std::vector<std::vector<uint64_t>> _wheel;
+        uint64_t _currentTick = 0;
+        uint64_t _nextId = 1;
+
+        std::thread _timerThread;
+        std::condition_variable _stopCondition;
+        bool _stop = false;
+
+        void timerLoop();
+        void expire(uint64_t tick);
+
+    public:
+        explicit RequestTracker(std::chrono::milliseconds tickPeriod = std::chrono::milliseconds(10), size_t wheelSlots = 512);
+        ~RequestTracker();
+
+        RequestTracker(const RequestTracker&) = delete;
+        RequestTracker& operator=(const RequestTracker&) = delete;
+
+        // registers a request, returning its correlation data and the future of its response
+        std::future<mqtt::const_message_ptr> add(std::chrono::milliseconds timeout, std::string& correlationData);
+
+        // resolves the request matching the correlation data of msg, returns false if none is pending
+        bool complete(mqtt::const_message_ptr msg);
+
+        // fails a request that could not be sent
+        void fail(const std::string& correlationData, std::exception_ptr error);
+
+        size_t pending();
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+// Bounded lock-free single-producer single-consumer ring buffer. Each side keeps
+// a cached copy of the other side's position on its own cache line and only
+// reloads it when the ring looks full (producer) or empty (consumer), so in the
+// common case push and pop touch no shared cache line but the slot itself.
+// tryPush must only be called from one thread and tryPop from one other thread.
+template <typename T>
+class SpscQueue {
+    private:
+        static constexpr size_t cacheLineSize = 64;
+
+        std::unique_ptr<T[]> _slots;
+        size_t _mask;
+
+        // consumer side
+        alignas(cacheLineSize) std::atomic<size_t> _head{0};
+        size_t _cachedTail = 0;
+
+        // producer side
+        alignas(cacheLineSize) std::atomic<size_t> _tail{0};
+        size_t _cachedHead = 0;
+
+        static size_t roundUpPowerOfTwo(size_t value){
+            size_t result = 2;
+            while(result < value){
+                result <<= 1;
+            }
+            return result;
+        }
+
+    public:
+        // capacity is rounded up to a power of two
+        explicit SpscQueue(size_t capacity)
+            : _slots(new T[roundUpPowerOfTwo(capacity)]), _mask(roundUpPowerOfTwo(capacity) - 1) {
+        }
+
+        SpscQueue(const SpscQueue&) = delete;
+        SpscQueue& operator=(const SpscQueue&) = delete;
+
+        // returns false when the queue is full, value is only moved from on success
+        bool tryPush(T&& value){
+            size_t tail = _tail.load(std::memory_order_relaxed);
+            if(tail - _cachedHead > _mask){
+                _cachedHead = _head.load(std::memory_order_acquire);
+                if(tail - _cachedHead > _mask){
+                    return false;
+                }
+            }
+            _slots[tail & _mask] = std::move(value);
+            _tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        // returns false when the queue is empty
+        bool tryPop(T& value){
+            size_t head = _head.load(std::memory_order_relaxed);
+            if(head == _cachedTail){
+                _cachedTail = _tail.load(std::memory_order_acquire);
+                if(head == _cachedTail){
+                    return false;
+                }
+            }
+            value = std::move(_slots[head & _mask]);
+            _head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        size_t capacity() const {
+            return _mask + 1;
+        }
+
+        // approximate while the producer or the consumer is running
+        size_t size() const {
+            size_t tail = _tail.load(std::memory_order_relaxed);
+            size_t head = _head.load(std::memory_order_relaxed);
+            return tail > head ? tail - head : 0;
+        }
+};
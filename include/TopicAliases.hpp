@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <mqtt/async_client.h>
+
+// MQTT v5 topic aliases of one connection. Outbound, the most recently published topics
+// keep an alias, at most the broker's Topic Alias Maximum, least recently used reassigned
+// first; a topic with an alias the broker already knows is sent as an empty topic plus
+// the 2 byte alias. Inbound, aliases the broker sets up are resolved back to their topic
+// before the message is matched against the handlers. Both sides start over on every
+// connection, as the aliases die with it.
+class TopicAliases {
+    public:
+        struct settings {
+            // publishes use aliases
+            bool outbound = true;
+            // upper bound on the aliases used for publishing, 0 for the broker's Topic Alias Maximum
+            uint16_t maxOutbound = 0;
+            // Topic Alias Maximum announced to the broker for the messages it sends, 0 for none
+            uint16_t maxInbound = 0;
+            // a QoS 1/2 message in flight is resent on the next connection, where its alias
+            // means nothing, so by default only QoS 0 publishes are aliased. Publishes made while
+            // disconnected, which paho buffers whatever their QoS, are never aliased
+            bool qos0Only = true;
+        };
+
+        struct counters {
+            // publishes sent with an empty topic and an alias
+            uint64_t hits = 0;
+            // publishes sent with their topic, setting up an alias
+            uint64_t misses = 0;
+            // aliases taken from the least recently used topic
+            uint64_t evictions = 0;
+            // topic bytes left out, less the alias properties
+            int64_t bytesSaved = 0;
+            uint64_t inboundRegistered = 0;
+            uint64_t inboundResolved = 0;
+            // messages with an alias never set up, dropped
+            uint64_t inboundUnknown = 0;
+
+            double hitRate() const {
+                return hits + misses == 0 ? 0.0 : static_cast<double>(hits) / static_cast<double>(hits + misses);
+            }
+        };
+
+    private:
+        settings _settings;
+
+        // outbound, aliases in use from most to least recently published
+        std::mutex _outboundMutex;
+        std::atomic<uint16_t> _maxOutbound{0};
+        std::list<std::pair<std::string, uint16_t>> _recent;
+        std::unordered_map<std::string, std::list<std::pair<std::string, uint16_t>>::iterator> _outbound;
+        // next alias never handed out on this connection, and those given back by forget
+        uint32_t _nextAlias = 1;
+        std::vector<uint16_t> _freeAliases;
+
+        // inbound, topic of each alias, touched by the paho callback thread only
+        std::vector<mqtt::string_ref> _inbound;
+
+        std::atomic<uint64_t> _hits{0};
+        std::atomic<uint64_t> _misses{0};
+        std::atomic<uint64_t> _evictions{0};
+        std::atomic<int64_t> _bytesSaved{0};
+        std::atomic<uint64_t> _inboundRegistered{0};
+        std::atomic<uint64_t> _inboundResolved{0};
+        std::atomic<uint64_t> _inboundUnknown{0};
+
+        void resetOutbound(uint16_t maximum);
+
+    public:
+        void configure(settings aliasSettings);
+        const settings& getSettings() const;
+
+        // starts a connection whose CONNACK allows brokerMaximum aliases, 0 turns them off
+        // until the next connection. Called from the paho callback thread
+        void connected(uint16_t brokerMaximum);
+
+        // forgets outbound aliases and assigns none until the next connection, from any
+        // thread. The inbound ones stay until connected
+        void stopOutbound();
+
+        bool active() const {
+            return _maxOutbound.load(std::memory_order_relaxed) != 0;
+        }
+
+        // aliases are assigned and their messages handed to paho under this lock, so the
+        // packet setting up an alias always goes out before the ones using it
+        std::unique_lock<std::mutex> outboundLock();
+
+        // alias to publish topic with, 0 for none. known is set when the broker has it already
+        // and the topic can be left out. The caller holds outboundLock
+        uint16_t assign(const std::string& topic, int qos, bool& known);
+
+        // drops the alias of a topic whose publish never reached paho. The caller holds outboundLock
+        void forget(const std::string& topic);
+
+        // msg with its aliased topic filled in, msg itself without an alias, null for an
+        // alias the broker never set up
+        mqtt::const_message_ptr resolve(mqtt::const_message_ptr msg);
+
+        counters getCounters() const;
+};
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Index of MQTT topic filters segmented by topic level. Every node is one level
+// of a filter, with dedicated slots for the '+' and '#' wildcards, so all the
+// filters matching a topic are found in a single walk of the topic levels instead
+// of testing the topic against each registered filter.
+template <typename T>
+class TopicTrie {
+    private:
+        struct Node {
+            // the level string is owned by the node, children keys are views into it
+            std::string level;
+            std::unordered_map<std::string_view, std::unique_ptr<Node>> children;
+            // child for the '+' wildcard
+            std::unique_ptr<Node> singleLevel;
+            // values of filters ending at this node
+            std::vector<T> values;
+            // values of filters ending at this node followed by '#'
+            std::vector<T> multiLevelValues;
+        };
+
+        Node _root;
+        size_t _size = 0;
+
+        template <typename F>
+        static void emit(const std::vector<T>& values, F& callback){
+            for(const T& value : values){
+                callback(value);
+            }
+        }
+
+        template <typename F>
+        static void matchLevel(const Node& node, std::string_view topic, size_t start, bool wildcards, F& callback){
+            size_t end = topic.find('/', start);
+            if(end == std::string_view::npos){
+                end = topic.length();
+            }
+            if(wildcards){
+                emit(node.multiLevelValues, callback);
+            }
+            auto child = node.children.find(topic.substr(start, end - start));
+            if(child != node.children.end()){
+                descend(*child->second, topic, end, callback);
+            }
+            if(wildcards && node.singleLevel){
+                descend(*node.singleLevel, topic, end, callback);
+            }
+        }
+
+        template <typename F>
+        static void descend(const Node& node, std::string_view topic, size_t end, F& callback){
+            if(end == topic.length()){
+                // "a/#" also matches the parent level "a"
+                emit(node.values, callback);
+                emit(node.multiLevelValues, callback);
+            } else {
+                matchLevel(node, topic, end + 1, true, callback);
+            }
+        }
+
+        template <typename P>
+        static size_t eraseLevel(Node& node, std::string_view filter, size_t start, P& erased){
+            size_t end = filter.find('/', start);
+            bool last = end == std::string_view::npos;
+            std::string_view level = filter.substr(start, last ? std::string_view::npos : end - start);
+            if(level == "#"){
+                return last ? eraseValues(node.multiLevelValues, erased) : 0;
+            }
+            Node* child = nullptr;
+            auto named = node.children.end();
+            if(level == "+"){
+                child = node.singleLevel.get();
+            } else {
+                named = node.children.find(level);
+                child = named == node.children.end() ? nullptr : named->second.get();
+            }
+            if(!child){
+                return 0;
+            }
+            size_t count = last ? eraseValues(child->values, erased) : eraseLevel(*child, filter, end + 1, erased);
+            // drop the levels no filter ends at or goes through anymore
+            if(child->values.empty() && child->multiLevelValues.empty() && child->children.empty() && !child->singleLevel){
+                if(level == "+"){
+                    node.singleLevel.reset();
+                } else {
+                    node.children.erase(named);
+                }
+            }
+            return count;
+        }
+
+        template <typename P>
+        static size_t eraseValues(std::vector<T>& values, P& erased){
+            size_t before = values.size();
+            values.erase(std::remove_if(values.begin(), values.end(), erased), values.end());
+            return before - values.size();
+        }
+
+    public:
+        TopicTrie() = default;
+        TopicTrie(const TopicTrie&) = delete;
+        TopicTrie& operator=(const TopicTrie&) = delete;
+
+        // adds a value for a topic filter; throws std::invalid_argument for malformed filters
+        void insert(const std::string& filter, T value){
+            Node* node = &_root;
+            size_t start = 0;
+            while(true){
+                size_t end = filter.find('/', start);
+                bool last = end == std::string::npos;
+                std::string_view level = std::string_view(filter).substr(start, last ? std::string::npos : end - start);
+                if(level == "#"){
+                    if(!last){
+                        throw std::invalid_argument("'#' must be the last level of a topic filter: " + filter);
+                    }
+                    node->multiLevelValues.push_back(std::move(value));
+                    break;
+                }
+                if(level.find_first_of("+#") != std::string_view::npos && level != "+"){
+                    throw std::invalid_argument("wildcards must occupy a whole topic level: " + filter);
+                }
+                if(level == "+"){
+                    if(!node->singleLevel){
+                        node->singleLevel = std::make_unique<Node>();
+                    }
+                    node = node->singleLevel.get();
+                } else {
+                    auto child = node->children.find(level);
+                    if(child == node->children.end()){
+                        auto newNode = std::make_unique<Node>();
+                        newNode->level = std::string(level);
+                        std::string_view key = newNode->level;
+                        child = node->children.emplace(key, std::move(newNode)).first;
+                    }
+                    node = child->second.get();
+                }
+                if(last){
+                    node->values.push_back(std::move(value));
+                    break;
+                }
+                start = end + 1;
+            }
+            ++_size;
+        }
+
+        // removes the values of exactly this filter for which erased(const T&) is true, and
+        // returns how many
+        template <typename P>
+        size_t erase(const std::string& filter, P erased){
+            size_t count = eraseLevel(_root, filter, 0, erased);
+            _size -= count;
+            return count;
+        }
+
+        // calls callback(const T&) once for every value whose filter matches the topic.
+        // Following the MQTT spec, wildcards at the first level do not match topics starting with '$'
+        template <typename F>
+        void forEachMatch(std::string_view topic, F&& callback) const {
+            bool systemTopic = !topic.empty() && topic[0] == '$';
+            matchLevel(_root, topic, 0, !systemTopic, callback);
+        }
+
+        void match(std::string_view topic, std::vector<T>& matches) const {
+            forEachMatch(topic, [&matches](const T& value){
+                matches.push_back(value);
+            });
+        }
+
+        size_t size() const {
+            return _size;
+        }
+
+        bool empty() const {
+            return _size == 0;
+        }
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <string>
+
+#include <mqtt/async_client.h>
+
+#include "MqttClient.hpp"
+#include "coro/CoroExecutor.hpp"
+#include "coro/MessageStream.hpp"
+
+// C++20 coroutine front end of MqttClient. Every operation returns an awaitable that
+// suspends the calling coroutine until the broker answered, then resumes it on the
+// executor; failures are rethrown as mqtt::exception. The strings passed to an operation
+// must stay alive until it is awaited, which holds when it is awaited in the same
+// expression as usual:
+//
+//     co_await client.connect();
+//     co_await client.publish("sensors/1", payload, 1);
+//     auto stream = client.stream("commands/#");
+//     while(auto msg = co_await stream->next()){ ... }
+class AsyncMqttClient {
+    public:
+        // iaction_listener for one operation, living in the frame of the suspended coroutine
+        class actionAwaiter: public virtual mqtt::iaction_listener {
+            private:
+                CoroExecutor& _executor;
+                std::coroutine_handle<> _awaiting;
+                std::exception_ptr _exception;
+
+                void on_failure(const mqtt::token& tok) override;
+                void on_success(const mqtt::token& tok) override;
+
+            protected:
+                MqttClient& _client;
+                int _messageId = 0;
+
+                // hands the operation to paho with this as its listener
+                virtual void submit() = 0;
+
+                void rethrowFailure() const;
+
+            public:
+                actionAwaiter(MqttClient& client, CoroExecutor& executor);
+                bool await_ready() const noexcept { return false; }
+                void await_suspend(std::coroutine_handle<> awaiting);
+                void await_resume() const;
+        };
+
+        class connectAwaiter: public actionAwaiter {
+            protected:
+                void submit() override;
+            public:
+                using actionAwaiter::actionAwaiter;
+        };
+
+        // resumes with the message id once the message is delivered
+        class publishAwaiter: public actionAwaiter {
+            private:
+                const std::string& _topic;
+                const std::string& _payload;
+                int _qos;
+                bool _retain;
+            protected:
+                void submit() override;
+            public:
+                publishAwaiter(MqttClient& client, CoroExecutor& executor, const std::string& topic, const std::string& payload, int qos, bool retain);
+                int await_resume() const;
+        };
+
+        class subscribeAwaiter: public actionAwaiter {
+            private:
+                const std::string& _topicFilter;
+                int _qos;
+            protected:
+                void submit() override;
+            public:
+                subscribeAwaiter(MqttClient& client, CoroExecutor& executor, const std::string& topicFilter, int qos);
+        };
+
+    private:
+        MqttClient& _client;
+        CoroExecutor& _executor;
+
+    public:
+        AsyncMqttClient(MqttClient& client, CoroExecutor& executor);
+
+        // starts the client, resumes once the connection is accepted
+        connectAwaiter connect();
+
+        // resumes on PUBACK/PUBCOMP for QoS 1/2, once sent for QoS 0
+        publishAwaiter publish(const std::string& topic, const std::string& payload, int qos = 0, bool retain = false);
+
+        // resumes on SUBACK
+        subscribeAwaiter subscribe(const std::string& topicFilter, int qos = 0);
+
+        // Registers a handler for topicFilter feeding the returned stream, subscribed like any
+        // other filter registered with MqttClient::on. Each filter can back one stream: throws
+        // std::invalid_argument if topicFilter already has a handler
+        std::shared_ptr<MessageStream> stream(const std::string& topicFilter, size_t capacity = 1024);
+
+        CoroExecutor& executor();
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <coroutine>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "MpmcQueue.hpp"
+#include "Parker.hpp"
+
+// Small pool of threads resuming coroutines. Awaitables of the coroutine layer post the
+// handle of the coroutine they suspended here once their operation completes, so any
+// number of logical flows share the few threads of the executor instead of blocking one
+// thread each. Handles go through a lock-free ring; if it is full they spill into a
+// mutex guarded overflow list rather than blocking the paho thread that posts them.
+class CoroExecutor {
+    public:
+        // awaitable moving the awaiting coroutine onto one of the executor threads
+        class scheduleAwaiter {
+            private:
+                CoroExecutor& _executor;
+            public:
+                explicit scheduleAwaiter(CoroExecutor& executor) : _executor(executor) {}
+                bool await_ready() const noexcept { return false; }
+                void await_suspend(std::coroutine_handle<> awaiting) { _executor.post(awaiting); }
+                void await_resume() const noexcept {}
+        };
+
+    private:
+        MpmcQueue<std::coroutine_handle<>> _ready;
+        std::mutex _overflowMutex;
+        std::deque<std::coroutine_handle<>> _overflow;
+        std::atomic<size_t> _overflowSize{0};
+
+        Parker _notEmpty;
+        std::atomic<bool> _stopExecution{false};
+        std::vector<std::thread> _threads;
+
+        bool tryTake(std::coroutine_handle<>& handle);
+        void threadLoop();
+
+    public:
+        explicit CoroExecutor(int numThreads = 2, size_t queueCapacity = 65536);
+        // stops the threads once the handles already posted ran. Coroutines still
+        // suspended on an operation are not resumed
+        ~CoroExecutor();
+
+        CoroExecutor(const CoroExecutor&) = delete;
+        CoroExecutor& operator=(const CoroExecutor&) = delete;
+
+        // resumes handle on an executor thread
+        void post(std::coroutine_handle<> handle);
+
+        scheduleAwaiter schedule();
+};
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "coro/CoroExecutor.hpp"
+
+template <typename T>
+class CoroTask;
+
+// state shared by the promises of every CoroTask
+struct coroPromiseBase {
+    // resumes whoever awaited the task, by symmetric transfer so long chains of
+    // tasks completing synchronously do not grow the stack
+    struct finalAwaiter {
+        bool await_ready() const noexcept { return false; }
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> finished) noexcept {
+            std::coroutine_handle<> continuation = finished.promise().continuation;
+            return continuation ? continuation : std::noop_coroutine();
+        }
+        void await_resume() const noexcept {}
+    };
+
+    std::coroutine_handle<> continuation;
+    std::exception_ptr exception;
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    finalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() noexcept { exception = std::current_exception(); }
+};
+
+template <typename T>
+struct coroPromise : coroPromiseBase {
+    std::optional<T> value;
+
+    CoroTask<T> get_return_object() noexcept;
+
+    template <typename U>
+    void return_value(U&& result){
+        value.emplace(std::forward<U>(result));
+    }
+
+    T result(){
+        if(exception){
+            std::rethrow_exception(exception);
+        }
+        return std::move(*value);
+    }
+};
+
+template <>
+struct coroPromise<void> : coroPromiseBase {
+    CoroTask<void> get_return_object() noexcept;
+
+    void return_void() const noexcept {}
+
+    void result(){
+        if(exception){
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+// Lazily started coroutine returning T: its body runs when it is first awaited, on the
+// awaiting thread, and the awaiting coroutine resumes where the body finishes. Exceptions
+// escaping the body are rethrown to the awaiter. Use spawn to start one from plain code.
+template <typename T = void>
+class CoroTask {
+    public:
+        using promise_type = coroPromise<T>;
+
+        class awaiter {
+            private:
+                std::coroutine_handle<promise_type> _handle;
+            public:
+                explicit awaiter(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+                bool await_ready() const noexcept { return _handle.done(); }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                    _handle.promise().continuation = awaiting;
+                    return _handle;
+                }
+                T await_resume() { return _handle.promise().result(); }
+        };
+
+    private:
+        std::coroutine_handle<promise_type> _handle;
+
+    public:
+        explicit CoroTask(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+        CoroTask(CoroTask&& other) noexcept : _handle(std::exchange(other._handle, nullptr)) {}
+        CoroTask& operator=(CoroTask&& other) noexcept {
+            if(this != &other){
+                if(_handle){
+                    _handle.destroy();
+                }
+                _handle = std::exchange(other._handle, nullptr);
+            }
+            return *this;
+        }
+        CoroTask(const CoroTask&) = delete;
+        CoroTask& operator=(const CoroTask&) = delete;
+        ~CoroTask(){
+            if(_handle){
+                _handle.destroy();
+            }
+        }
+
+        awaiter operator co_await() const noexcept {
+            return awaiter(_handle);
+        }
+};
+
+template <typename T>
+CoroTask<T> coroPromise<T>::get_return_object() noexcept {
+    return CoroTask<T>(std::coroutine_handle<coroPromise<T>>::from_promise(*this));
+}
+
+inline CoroTask<void> coroPromise<void>::get_return_object() noexcept {
+    return CoroTask<void>(std::coroutine_handle<coroPromise<void>>::from_promise(*this));
+}
+
+// coroutine owning its own frame, destroyed when the body returns
+struct coroDetached {
+    struct promise_type {
+        coroDetached get_return_object() const noexcept { return {}; }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+};
+
+template <typename T>
+coroDetached runDetached(CoroExecutor& executor, CoroTask<T> task, std::promise<T> result){
+    co_await executor.schedule();
+    try {
+        if constexpr (std::is_void_v<T>){
+            co_await task;
+            result.set_value();
+        } else {
+            result.set_value(co_await task);
+        }
+    } catch (...) {
+        result.set_exception(std::current_exception());
+    }
+}
+
+// Starts task on the executor and returns at once. The future gets its result or its
+// exception; dropping the future leaves the task running on its own
+template <typename T>
+std::future<T> spawn(CoroExecutor& executor, CoroTask<T> task){
+    std::promise<T> result;
+    std::future<T> future = result.get_future();
+    runDetached(executor, std::move(task), std::move(result));
+    return future;
+}
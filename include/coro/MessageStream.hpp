@@ -0,0 +1,59 @@
+#pragma once
+
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "coro/CoroExecutor.hpp"
+
+// Messages of one topic filter as an asynchronous sequence: the dispatcher workers push
+// into a bounded buffer and `co_await stream.next()` takes them out in arrival order,
+// suspending while the buffer is empty. A full buffer drops its oldest message instead of
+// stalling the workers. One coroutine at a time may wait on next().
+class MessageStream {
+    public:
+        struct message {
+            std::string topic;
+            std::string payload;
+        };
+
+        // resumes with the next message, or with nullopt once the stream is closed and drained
+        class nextAwaiter {
+            private:
+                MessageStream& _stream;
+            public:
+                explicit nextAwaiter(MessageStream& stream) : _stream(stream) {}
+                bool await_ready() const noexcept { return false; }
+                bool await_suspend(std::coroutine_handle<> awaiting);
+                std::optional<message> await_resume();
+        };
+
+    private:
+        CoroExecutor& _executor;
+        size_t _capacity;
+
+        std::mutex _mutex;
+        std::deque<message> _buffered;
+        std::coroutine_handle<> _waiting;
+        bool _closed = false;
+        uint64_t _dropped = 0;
+
+    public:
+        MessageStream(CoroExecutor& executor, size_t capacity);
+
+        // called from the message handler, copies the message into the buffer
+        void push(std::string_view topic, std::string_view payload);
+
+        nextAwaiter next();
+
+        // ends the stream: messages arriving afterwards are discarded, the waiter resumes
+        // with nullopt once the buffered ones are taken
+        void close();
+
+        // messages discarded because the buffer was full
+        uint64_t dropped();
+};
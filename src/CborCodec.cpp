@@ -0,0 +1,388 @@
+#include "CborCodec.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+CborValue CborValue::fromInt(int64_t value){
+    CborValue result;
+    if(value >= 0){
+        result.type = CBOR_UNSIGNED;
+        result.integer = static_cast<uint64_t>(value);
+    } else {
+        result.type = CBOR_NEGATIVE;
+        result.integer = static_cast<uint64_t>(-(value + 1));
+    }
+    return result;
+}
+
+CborValue CborValue::fromUnsigned(uint64_t value){
+    CborValue result;
+    result.type = CBOR_UNSIGNED;
+    result.integer = value;
+    return result;
+}
+
+CborValue CborValue::fromDouble(double value){
+    CborValue result;
+    result.type = CBOR_FLOAT;
+    result.floating = value;
+    return result;
+}
+
+CborValue CborValue::fromBool(bool value){
+    CborValue result;
+    result.type = CBOR_BOOL;
+    result.integer = value ? 1 : 0;
+    return result;
+}
+
+CborValue CborValue::fromText(std::string_view text){
+    CborValue result;
+    result.type = CBOR_TEXT;
+    result.bytes = text;
+    return result;
+}
+
+CborValue CborValue::fromBytes(std::string_view bytes){
+    CborValue result;
+    result.type = CBOR_BYTES;
+    result.bytes = bytes;
+    return result;
+}
+
+CborValue CborValue::array(std::vector<CborValue> items){
+    CborValue result;
+    result.type = CBOR_ARRAY;
+    result.items = std::move(items);
+    return result;
+}
+
+CborValue CborValue::map(std::vector<std::pair<CborValue, CborValue>> entries){
+    CborValue result;
+    result.type = CBOR_MAP;
+    result.entries = std::move(entries);
+    return result;
+}
+
+bool CborValue::isInteger() const {
+    return type == CBOR_UNSIGNED || type == CBOR_NEGATIVE;
+}
+
+int64_t CborValue::asInt64() const {
+    if(!isInteger() || integer > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())){
+        throw std::out_of_range("CBOR item is not an int64");
+    }
+    int64_t value = static_cast<int64_t>(integer);
+    return type == CBOR_UNSIGNED ? value : -1 - value;
+}
+
+double CborValue::asDouble() const {
+    switch(type){
+        case CBOR_FLOAT:
+            return floating;
+        case CBOR_UNSIGNED:
+            return static_cast<double>(integer);
+        case CBOR_NEGATIVE:
+            return -1.0 - static_cast<double>(integer);
+        default:
+            throw std::out_of_range("CBOR item is not a number");
+    }
+}
+
+const CborValue* CborValue::find(std::string_view key) const {
+    if(type != CBOR_MAP){
+        return nullptr;
+    }
+    for(const auto& entry : entries){
+        if(entry.first.type == CBOR_TEXT && entry.first.bytes == key){
+            return &entry.second;
+        }
+    }
+    return nullptr;
+}
+
+namespace {
+
+    class cborReader {
+        private:
+            std::string_view _data;
+            size_t _pos = 0;
+
+            [[noreturn]] static void malformed(const char* reason){
+                throw std::invalid_argument(std::string("Malformed CBOR: ") + reason);
+            }
+
+            uint8_t byte(){
+                if(_pos >= _data.size()){
+                    malformed("truncated");
+                }
+                return static_cast<uint8_t>(_data[_pos++]);
+            }
+
+            uint64_t bigEndian(size_t length){
+                if(_data.size() - _pos < length){
+                    malformed("truncated");
+                }
+                uint64_t value = 0;
+                for(size_t i = 0; i < length; ++i){
+                    value = (value << 8) | static_cast<uint8_t>(_data[_pos++]);
+                }
+                return value;
+            }
+
+            // argument of a head whose additional information is info, indefinite is set for 31
+            uint64_t argument(uint8_t info, bool& indefinite){
+                indefinite = false;
+                if(info < 24){
+                    return info;
+                }
+                switch(info){
+                    case 24: return bigEndian(1);
+                    case 25: return bigEndian(2);
+                    case 26: return bigEndian(4);
+                    case 27: return bigEndian(8);
+                    case 31: indefinite = true; return 0;
+                    default: malformed("reserved additional information");
+                }
+            }
+
+            // every item takes at least one byte, which bounds counts read from the payload
+            size_t count(uint64_t value, size_t bytesPerItem){
+                if(value > (_data.size() - _pos) / bytesPerItem){
+                    malformed("count larger than the payload");
+                }
+                return static_cast<size_t>(value);
+            }
+
+            bool atBreak(){
+                if(_pos >= _data.size()){
+                    malformed("truncated");
+                }
+                if(static_cast<uint8_t>(_data[_pos]) == 0xff){
+                    ++_pos;
+                    return true;
+                }
+                return false;
+            }
+
+            static double halfToDouble(uint16_t half){
+                int exponent = (half >> 10) & 0x1f;
+                double mantissa = half & 0x3ff;
+                double value;
+                if(exponent == 0){
+                    value = std::ldexp(mantissa, -24);
+                } else if(exponent != 31){
+                    value = std::ldexp(mantissa + 1024, exponent - 25);
+                } else {
+                    value = mantissa == 0 ? std::numeric_limits<double>::infinity() : std::numeric_limits<double>::quiet_NaN();
+                }
+                return (half & 0x8000) ? -value : value;
+            }
+
+        public:
+            explicit cborReader(std::string_view data) : _data(data) {}
+
+            bool done() const {
+                return _pos == _data.size();
+            }
+
+            CborValue item(int depth){
+                if(depth > CborCodec::maxDepth){
+                    malformed("nested too deeply");
+                }
+                CborValue value;
+                uint8_t head = byte();
+                uint8_t major = head >> 5;
+                uint8_t info = head & 0x1f;
+                while(major == 6){
+                    bool indefinite;
+                    value.tags.push_back(argument(info, indefinite));
+                    if(indefinite){
+                        malformed("indefinite tag");
+                    }
+                    head = byte();
+                    major = head >> 5;
+                    info = head & 0x1f;
+                }
+                if(major == 7){
+                    switch(info){
+                        case 20: value.type = CborValue::CBOR_BOOL; value.integer = 0; return value;
+                        case 21: value.type = CborValue::CBOR_BOOL; value.integer = 1; return value;
+                        case 22: value.type = CborValue::CBOR_NULL; return value;
+                        case 23: value.type = CborValue::CBOR_UNDEFINED; return value;
+                        case 24: value.type = CborValue::CBOR_SIMPLE; value.integer = bigEndian(1); return value;
+                        case 25: value.type = CborValue::CBOR_FLOAT; value.floating = halfToDouble(static_cast<uint16_t>(bigEndian(2))); return value;
+                        case 26: {
+                            uint32_t bits = static_cast<uint32_t>(bigEndian(4));
+                            float single;
+                            std::memcpy(&single, &bits, sizeof(single));
+                            value.type = CborValue::CBOR_FLOAT;
+                            value.floating = single;
+                            return value;
+                        }
+                        case 27: {
+                            uint64_t bits = bigEndian(8);
+                            value.type = CborValue::CBOR_FLOAT;
+                            std::memcpy(&value.floating, &bits, sizeof(value.floating));
+                            return value;
+                        }
+                        case 31: malformed("unexpected break");
+                        default:
+                            if(info >= 28){
+                                malformed("reserved additional information");
+                            }
+                            value.type = CborValue::CBOR_SIMPLE;
+                            value.integer = info;
+                            return value;
+                    }
+                }
+
+                bool indefinite;
+                uint64_t arg = argument(info, indefinite);
+                value.type = static_cast<CborValue::Type>(major);
+                switch(major){
+                    case 0:
+                    case 1:
+                        if(indefinite){
+                            malformed("indefinite integer");
+                        }
+                        value.integer = arg;
+                        return value;
+                    case 2:
+                    case 3: {
+                        if(indefinite){
+                            malformed("indefinite length strings are not supported");
+                        }
+                        size_t length = count(arg, 1);
+                        value.bytes = _data.substr(_pos, length);
+                        _pos += length;
+                        return value;
+                    }
+                    case 4:
+                        if(indefinite){
+                            while(!atBreak()){
+                                value.items.push_back(item(depth + 1));
+                            }
+                        } else {
+                            size_t items = count(arg, 1);
+                            value.items.reserve(items);
+                            for(size_t i = 0; i < items; ++i){
+                                value.items.push_back(item(depth + 1));
+                            }
+                        }
+                        return value;
+                    default: {
+                        if(indefinite){
+                            while(!atBreak()){
+                                CborValue key = item(depth + 1);
+                                value.entries.emplace_back(std::move(key), item(depth + 1));
+                            }
+                        } else {
+                            size_t entries = count(arg, 2);
+                            value.entries.reserve(entries);
+                            for(size_t i = 0; i < entries; ++i){
+                                CborValue key = item(depth + 1);
+                                value.entries.emplace_back(std::move(key), item(depth + 1));
+                            }
+                        }
+                        return value;
+                    }
+                }
+            }
+    };
+
+    void writeHead(std::string& out, uint8_t major, uint64_t argument){
+        uint8_t type = static_cast<uint8_t>(major << 5);
+        if(argument < 24){
+            out += static_cast<char>(type | argument);
+            return;
+        }
+        int length;
+        if(argument <= 0xff){
+            out += static_cast<char>(type | 24);
+            length = 1;
+        } else if(argument <= 0xffff){
+            out += static_cast<char>(type | 25);
+            length = 2;
+        } else if(argument <= 0xffffffff){
+            out += static_cast<char>(type | 26);
+            length = 4;
+        } else {
+            out += static_cast<char>(type | 27);
+            length = 8;
+        }
+        for(int i = length - 1; i >= 0; --i){
+            out += static_cast<char>((argument >> (8 * i)) & 0xff);
+        }
+    }
+
+    void writeItem(std::string& out, const CborValue& value, int depth){
+        if(depth > CborCodec::maxDepth){
+            throw std::invalid_argument("CBOR value nested too deeply");
+        }
+        for(uint64_t tag : value.tags){
+            writeHead(out, 6, tag);
+        }
+        switch(value.type){
+            case CborValue::CBOR_UNSIGNED:
+            case CborValue::CBOR_NEGATIVE:
+                writeHead(out, static_cast<uint8_t>(value.type), value.integer);
+                break;
+            case CborValue::CBOR_BYTES:
+            case CborValue::CBOR_TEXT:
+                writeHead(out, static_cast<uint8_t>(value.type), value.bytes.size());
+                out.append(value.bytes);
+                break;
+            case CborValue::CBOR_ARRAY:
+                writeHead(out, 4, value.items.size());
+                for(const CborValue& item : value.items){
+                    writeItem(out, item, depth + 1);
+                }
+                break;
+            case CborValue::CBOR_MAP:
+                writeHead(out, 5, value.entries.size());
+                for(const auto& entry : value.entries){
+                    writeItem(out, entry.first, depth + 1);
+                    writeItem(out, entry.second, depth + 1);
+                }
+                break;
+            case CborValue::CBOR_BOOL:
+                out += static_cast<char>(value.integer ? 0xf5 : 0xf4);
+                break;
+            case CborValue::CBOR_NULL:
+                out += static_cast<char>(0xf6);
+                break;
+            case CborValue::CBOR_UNDEFINED:
+                out += static_cast<char>(0xf7);
+                break;
+            case CborValue::CBOR_SIMPLE:
+                writeHead(out, 7, value.integer);
+                break;
+            case CborValue::CBOR_FLOAT: {
+                uint64_t bits;
+                std::memcpy(&bits, &value.floating, sizeof(bits));
+                out += static_cast<char>(0xfb);
+                for(int i = 7; i >= 0; --i){
+                    out += static_cast<char>((bits >> (8 * i)) & 0xff);
+                }
+                break;
+            }
+        }
+    }
+
+}
+
+CborValue CborCodec::decode(std::string_view payload) const {
+    cborReader reader(payload);
+    CborValue value = reader.item(0);
+    if(!reader.done()){
+        throw std::invalid_argument("Malformed CBOR: trailing bytes");
+    }
+    return value;
+}
+
+void CborCodec::encode(const CborValue& value, std::string& out) const {
+    writeItem(out, value, 0);
+}
@@ -0,0 +1,64 @@
+#include "EpochReclaimer.hpp"
+
+#include <thread>
+
+// reader stripe of the calling thread
+static size_t threadStripe(size_t stripes){
+    thread_local const size_t hashed = std::hash<std::thread::id>()(std::this_thread::get_id());
+    return hashed % stripes;
+}
+
+EpochReclaimer::EpochReclaimer(size_t reclaimBatch)
+    : _reclaimBatch(reclaimBatch > 0 ? reclaimBatch : 1) {
+}
+
+EpochReclaimer::~EpochReclaimer(){
+    for(auto& pending : _retired){
+        for(auto& release : pending){
+            release();
+        }
+    }
+}
+
+uint64_t EpochReclaimer::enter() const {
+    size_t stripe = threadStripe(readerStripes);
+    while(true){
+        uint64_t epoch = _epoch.load();
+        _readers[stripe].count[epoch & 1].fetch_add(1);
+        // registered in an epoch the writer may have moved past, try again in the current one
+        if(_epoch.load() == epoch){
+            return epoch;
+        }
+        _readers[stripe].count[epoch & 1].fetch_sub(1);
+    }
+}
+
+void EpochReclaimer::exit(uint64_t epoch) const {
+    _readers[threadStripe(readerStripes)].count[epoch & 1].fetch_sub(1);
+}
+
+void EpochReclaimer::retire(std::function<void()> release){
+    std::vector<std::function<void()>>& current = _retired[_epoch.load(std::memory_order_relaxed) & 1];
+    current.push_back(std::move(release));
+    if(current.size() >= _reclaimBatch){
+        reclaim();
+    }
+}
+
+void EpochReclaimer::reclaim(){
+    uint64_t epoch = _epoch.load();
+    // readers of the previous epoch may still hold what was retired in it
+    int64_t previousReaders = 0;
+    for(const readerStripe& stripe : _readers){
+        previousReaders += stripe.count[(epoch + 1) & 1].load();
+    }
+    if(previousReaders != 0){
+        return;
+    }
+    std::vector<std::function<void()>>& previous = _retired[(epoch + 1) & 1];
+    for(auto& release : previous){
+        release();
+    }
+    previous.clear();
+    _epoch.store(epoch + 1);
+}
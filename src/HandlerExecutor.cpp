@@ -0,0 +1,60 @@
+#include "HandlerExecutor.hpp"
+
+HandlerExecutor::HandlerExecutor(std::string name, int numThreads, size_t queueCapacity)
+    : _name(std::move(name)), _tasks(queueCapacity) {
+    for(int i = 0; i < numThreads; ++i){
+        _threads.emplace_back(&HandlerExecutor::threadLoop, this, static_cast<size_t>(i));
+    }
+}
+
+HandlerExecutor::~HandlerExecutor(){
+    _stopExecution = true;
+    _notEmpty.notifyAll();
+    for(auto& thread : _threads){
+        thread.join();
+    }
+}
+
+bool HandlerExecutor::tryPost(task work){
+    if(!_tasks.tryPush(std::move(work))){
+        return false;
+    }
+    _notEmpty.notifyOne();
+    return true;
+}
+
+const std::string& HandlerExecutor::name() const {
+    return _name;
+}
+
+size_t HandlerExecutor::numThreads() const {
+    return _threads.size();
+}
+
+size_t HandlerExecutor::queued() const {
+    return _tasks.size();
+}
+
+void HandlerExecutor::threadLoop(size_t threadIndex){
+    task work;
+    while(true){
+        if(_tasks.tryPop(work)){
+            work(threadIndex);
+            work = nullptr;
+            continue;
+        }
+        uint64_t epoch = _notEmpty.prepareWait();
+        if(_tasks.tryPop(work)){
+            _notEmpty.cancelWait();
+            work(threadIndex);
+            work = nullptr;
+            continue;
+        }
+        // drain what was posted before stopping
+        if(_stopExecution){
+            _notEmpty.cancelWait();
+            return;
+        }
+        _notEmpty.commitWait(epoch);
+    }
+}
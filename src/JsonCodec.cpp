@@ -0,0 +1,51 @@
+#include "JsonCodec.hpp"
+
+#ifdef MQTT_CLIENT_WITH_SIMDJSON
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+JsonCodec::JsonCodec(const JsonCodec& other)
+    : PayloadCodec<simdjson::dom::element>(other) {
+}
+
+JsonCodec& JsonCodec::operator=(const JsonCodec&){
+    return *this;
+}
+
+simdjson::dom::element JsonCodec::decode(std::string_view payload) const {
+    // one parser per codec, since a message can be decoded by several codecs at once. Keyed by
+    // the codec's key rather than its address, which a later codec may reuse
+    thread_local std::vector<std::pair<std::weak_ptr<const char>, std::unique_ptr<simdjson::dom::parser>>> parsers;
+    simdjson::dom::parser* parser = nullptr;
+    for(auto& entry : parsers){
+        if(!entry.first.owner_before(_parserKey) && !_parserKey.owner_before(entry.first)){
+            parser = entry.second.get();
+            break;
+        }
+    }
+    if(!parser){
+        // the parsers of destroyed codecs go before this thread takes a new one
+        parsers.erase(std::remove_if(parsers.begin(), parsers.end(), [](const auto& entry){
+            return entry.first.expired();
+        }), parsers.end());
+        parsers.emplace_back(_parserKey, std::make_unique<simdjson::dom::parser>());
+        parser = parsers.back().second.get();
+    }
+    // copies into a padded buffer, payloads are not allocated with simdjson's padding
+    simdjson::dom::element root;
+    simdjson::error_code error = parser->parse(payload.data(), payload.size(), true).get(root);
+    if(error){
+        throw std::invalid_argument(std::string("Malformed JSON: ") + simdjson::error_message(error));
+    }
+    return root;
+}
+
+void JsonCodec::encode(const simdjson::dom::element& value, std::string& out) const {
+    out += simdjson::minify(value);
+}
+
+#endif
@@ -0,0 +1,204 @@
+#include "LastValueCache.hpp"
+
+#include <functional>
+
+#include "MqttCallbacks.hpp"
+
+// per topic cost besides its topic and payload: entry, holder, message and slot
+static constexpr size_t entryOverhead = 256;
+
+LastValueCache::table::table(size_t capacity)
+    : mask(capacity - 1), slots(new std::atomic<entry*>[capacity]) {
+    for(size_t i = 0; i < capacity; ++i){
+        slots[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
+LastValueCache::LastValueCache(size_t budgetBytes)
+    : _table(new table(16)), _budgetBytes(budgetBytes) {
+}
+
+LastValueCache::~LastValueCache(){
+    table* current = _table.load(std::memory_order_relaxed);
+    for(size_t i = 0; i <= current->mask; ++i){
+        entry* stored = current->slots[i].load(std::memory_order_relaxed);
+        if(stored){
+            delete stored->value.load(std::memory_order_relaxed);
+            delete stored;
+        }
+    }
+    delete current;
+}
+
+void LastValueCache::setBudget(size_t budgetBytes){
+    _budgetBytes.store(budgetBytes, std::memory_order_relaxed);
+}
+
+LastValueCache::entry* LastValueCache::find(const table& current, std::string_view topic, size_t hash) const {
+    for(size_t i = hash & current.mask; ; i = (i + 1) & current.mask){
+        entry* stored = current.slots[i].load(std::memory_order_acquire);
+        if(!stored){
+            return nullptr;
+        }
+        if(stored->hash == hash && stored->topic == topic){
+            return stored;
+        }
+    }
+}
+
+LastValueCache::entry* LastValueCache::insert(const std::string& topic, size_t hash){
+    table* current = _table.load(std::memory_order_relaxed);
+    // at most half full, so probes stay short and always end on an empty slot
+    if((_used + 1) * 2 > current->mask + 1){
+        rebuild();
+        current = _table.load(std::memory_order_relaxed);
+    }
+    entry* created = new entry();
+    created->topic = topic;
+    created->hash = hash;
+    size_t i = hash & current->mask;
+    while(current->slots[i].load(std::memory_order_relaxed)){
+        i = (i + 1) & current->mask;
+    }
+    current->slots[i].store(created, std::memory_order_release);
+    ++_used;
+    return created;
+}
+
+void LastValueCache::rebuild(){
+    table* current = _table.load(std::memory_order_relaxed);
+    size_t live = _entries.load(std::memory_order_relaxed);
+    size_t capacity = 16;
+    while(capacity < (live + 1) * 4){
+        capacity *= 2;
+    }
+    table* rebuilt = new table(capacity);
+    _used = 0;
+    for(size_t i = 0; i <= current->mask; ++i){
+        entry* stored = current->slots[i].load(std::memory_order_relaxed);
+        if(!stored){
+            continue;
+        }
+        if(!stored->value.load(std::memory_order_relaxed)){
+            _reclaimer.retire([stored] { delete stored; });
+            continue;
+        }
+        size_t slot = stored->hash & rebuilt->mask;
+        while(rebuilt->slots[slot].load(std::memory_order_relaxed)){
+            slot = (slot + 1) & rebuilt->mask;
+        }
+        rebuilt->slots[slot].store(stored, std::memory_order_relaxed);
+        ++_used;
+    }
+    _table.store(rebuilt, std::memory_order_release);
+    _reclaimer.retire([current] { delete current; });
+}
+
+void LastValueCache::unlinkRecent(entry* updated){
+    if(updated->older){
+        updated->older->newer = updated->newer;
+    } else if(_oldest == updated){
+        _oldest = updated->newer;
+    }
+    if(updated->newer){
+        updated->newer->older = updated->older;
+    } else if(_newest == updated){
+        _newest = updated->older;
+    }
+    updated->older = updated->newer = nullptr;
+}
+
+void LastValueCache::clear(entry* stale){
+    holder* previous = stale->value.exchange(nullptr, std::memory_order_acq_rel);
+    if(!previous){
+        return;
+    }
+    unlinkRecent(stale);
+    _bytes.fetch_sub(previous->bytes, std::memory_order_relaxed);
+    _entries.fetch_sub(1, std::memory_order_relaxed);
+    _reclaimer.retire([previous] { delete previous; });
+}
+
+void LastValueCache::update(const mqtt::const_message_ptr& msg){
+    const std::string& topic = msg->get_topic();
+    size_t hash = std::hash<std::string_view>()(topic);
+    entry* stored = find(*_table.load(std::memory_order_relaxed), topic, hash);
+    _updates.fetch_add(1, std::memory_order_relaxed);
+
+    // an empty retained message deletes the retained value of its topic
+    if(msg->is_retained() && msg->get_payload().empty()){
+        if(stored){
+            clear(stored);
+            _cleared.fetch_add(1, std::memory_order_relaxed);
+        }
+        return;
+    }
+    if(!stored){
+        stored = insert(topic, hash);
+    }
+    holder* value = new holder{msg, topic.size() + msg->get_payload().size() + entryOverhead};
+    holder* previous = stored->value.exchange(value, std::memory_order_acq_rel);
+    if(previous){
+        _bytes.fetch_sub(previous->bytes, std::memory_order_relaxed);
+        unlinkRecent(stored);
+        _reclaimer.retire([previous] { delete previous; });
+    } else {
+        _entries.fetch_add(1, std::memory_order_relaxed);
+    }
+    _bytes.fetch_add(value->bytes, std::memory_order_relaxed);
+    stored->older = _newest;
+    if(_newest){
+        _newest->newer = stored;
+    }
+    _newest = stored;
+    if(!_oldest){
+        _oldest = stored;
+    }
+
+    size_t budget = _budgetBytes.load(std::memory_order_relaxed);
+    while(_bytes.load(std::memory_order_relaxed) > budget && _oldest && _oldest != stored){
+        clear(_oldest);
+        _evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+mqtt::const_message_ptr LastValueCache::latest(std::string_view topic) const {
+    size_t hash = std::hash<std::string_view>()(topic);
+    EpochReclaimer::guard reading(_reclaimer);
+    mqtt::const_message_ptr msg;
+    entry* stored = find(*_table.load(std::memory_order_acquire), topic, hash);
+    if(stored){
+        holder* value = stored->value.load(std::memory_order_acquire);
+        if(value){
+            msg = value->msg;
+        }
+    }
+    return msg;
+}
+
+std::vector<mqtt::const_message_ptr> LastValueCache::snapshot(const std::string& filter) const {
+    std::vector<mqtt::const_message_ptr> messages;
+    EpochReclaimer::guard reading(_reclaimer);
+    const table& current = *_table.load(std::memory_order_acquire);
+    for(size_t i = 0; i <= current.mask; ++i){
+        entry* stored = current.slots[i].load(std::memory_order_acquire);
+        if(!stored){
+            continue;
+        }
+        holder* value = stored->value.load(std::memory_order_acquire);
+        if(value && MqttCallbacks::isMqttTopicIncluded(stored->topic, filter)){
+            messages.push_back(value->msg);
+        }
+    }
+    return messages;
+}
+
+LastValueCache::counters LastValueCache::getCounters() const {
+    counters current;
+    current.updates = _updates.load(std::memory_order_relaxed);
+    current.evictions = _evictions.load(std::memory_order_relaxed);
+    current.cleared = _cleared.load(std::memory_order_relaxed);
+    current.entries = _entries.load(std::memory_order_relaxed);
+    current.bytes = _bytes.load(std::memory_order_relaxed);
+    return current;
+}
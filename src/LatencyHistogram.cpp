@@ -0,0 +1,77 @@
+#include "LatencyHistogram.hpp"
+
+size_t LatencyHistogram::bucketIndex(uint64_t value){
+    if(value < subBuckets){
+        return value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    if(exponent >= maxExponent){
+        return bucketCount - 1;
+    }
+    int shift = exponent - subBucketBits;
+    size_t subBucket = (value >> shift) - subBuckets;
+    return subBuckets + static_cast<size_t>(shift) * subBuckets + subBucket;
+}
+
+uint64_t LatencyHistogram::bucketValue(size_t index){
+    if(index < subBuckets){
+        return index;
+    }
+    int shift = static_cast<int>((index - subBuckets) / subBuckets);
+    uint64_t subBucket = (index - subBuckets) % subBuckets;
+    uint64_t lower = (subBuckets + subBucket) << shift;
+    return lower + (uint64_t(1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t nanoseconds){
+    _buckets[bucketIndex(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+    uint64_t max = _max.load(std::memory_order_relaxed);
+    while(nanoseconds > max && !_max.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed)){
+    }
+}
+
+void LatencyHistogram::addTo(std::array<uint64_t, bucketCount>& counts, summary& totals) const {
+    for(size_t i = 0; i < bucketCount; ++i){
+        counts[i] += _buckets[i].load(std::memory_order_relaxed);
+    }
+    totals.count += _count.load(std::memory_order_relaxed);
+    totals.sum += _sum.load(std::memory_order_relaxed);
+    uint64_t max = _max.load(std::memory_order_relaxed);
+    if(max > totals.max){
+        totals.max = max;
+    }
+}
+
+LatencyHistogram::summary LatencyHistogram::summarize() const {
+    std::array<uint64_t, bucketCount> counts{};
+    summary totals;
+    addTo(counts, totals);
+    return summarize(counts, totals);
+}
+
+LatencyHistogram::summary LatencyHistogram::summarize(const std::array<uint64_t, bucketCount>& counts, summary totals){
+    uint64_t bucketsTotal = 0;
+    for(uint64_t count : counts){
+        bucketsTotal += count;
+    }
+    if(bucketsTotal == 0){
+        return totals;
+    }
+    // rank of each percentile among the recorded values, rounded up
+    const double percentiles[] = {0.5, 0.9, 0.99, 0.999};
+    uint64_t* results[] = {&totals.p50, &totals.p90, &totals.p99, &totals.p999};
+    uint64_t seen = 0;
+    size_t next = 0;
+    for(size_t i = 0; i < bucketCount && next < 4; ++i){
+        seen += counts[i];
+        while(next < 4 && seen >= static_cast<uint64_t>(percentiles[next] * bucketsTotal + 0.999999)){
+            // never report more than the largest value actually recorded
+            uint64_t value = bucketValue(i);
+            *results[next] = totals.max != 0 && value > totals.max ? totals.max : value;
+            ++next;
+        }
+    }
+    return totals;
+}
@@ -0,0 +1,97 @@
+#include "MessagePool.hpp"
+
+#include <mutex>
+
+MessagePool::MessagePool(size_t slots, size_t maxTopics)
+    : _slots(slots), _maxTopics(maxTopics) {
+}
+
+mqtt::string_ref MessagePool::internTopic(const std::string& topic){
+    {
+        std::shared_lock<std::shared_mutex> lock(_topicsMutex);
+        auto interned = _topics.find(topic);
+        if(interned != _topics.end()){
+            return interned->second;
+        }
+    }
+    _topicAllocations.fetch_add(1, std::memory_order_relaxed);
+    mqtt::string_ref topicRef(topic);
+    std::unique_lock<std::shared_mutex> lock(_topicsMutex);
+    if(_topics.size() < _maxTopics){
+        _topics.emplace(topic, topicRef);
+    }
+    return topicRef;
+}
+
+void MessagePool::fill(slot& freeSlot, const std::string& topic, std::string_view payload, int qos, bool retain, const mqtt::properties* props){
+    if(!freeSlot.msg){
+        freeSlot.msg = std::make_shared<mqtt::message>();
+        _messageAllocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    // the buffer is shared with the message only, unless someone kept the payload of a published message
+    if(!freeSlot.payload || freeSlot.payload.use_count() > 2 || freeSlot.payload->capacity() < payload.size()){
+        freeSlot.payload = std::make_shared<std::string>(payload);
+        _payloadAllocations.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        freeSlot.payload->assign(payload.data(), payload.size());
+    }
+    if(freeSlot.msg->get_topic() != topic){
+        freeSlot.msg->set_topic(internTopic(topic));
+    }
+    // the buffer may have moved, point the message at it again
+    freeSlot.msg->set_payload(mqtt::binary_ref(std::shared_ptr<const std::string>(freeSlot.payload)));
+    freeSlot.msg->set_qos(qos);
+    freeSlot.msg->set_retained(retain);
+    if(props){
+        freeSlot.msg->set_properties(*props);
+        freeSlot.hasProperties = true;
+    } else if(freeSlot.hasProperties){
+        freeSlot.msg->set_properties(mqtt::properties());
+        freeSlot.hasProperties = false;
+    }
+}
+
+mqtt::message_ptr MessagePool::acquire(const std::string& topic, std::string_view payload, int qos, bool retain){
+    return acquire(topic, payload, qos, retain, mqtt::properties());
+}
+
+mqtt::message_ptr MessagePool::acquire(const std::string& topic, std::string_view payload, int qos, bool retain, const mqtt::properties& props){
+    _acquired.fetch_add(1, std::memory_order_relaxed);
+    const mqtt::properties* msgProps = props.empty() ? nullptr : &props;
+    // each thread resumes scanning where it last found a free slot
+    thread_local size_t cursor = 0;
+    for(size_t i = 0; i < _slots.size(); ++i){
+        slot& candidate = _slots[(cursor + i) % _slots.size()];
+        if(candidate.claimed.exchange(true, std::memory_order_acquire)){
+            continue;
+        }
+        // while claimed nobody else can take a reference, only paho can drop its own
+        if(candidate.msg && candidate.msg.use_count() > 1){
+            candidate.claimed.store(false, std::memory_order_release);
+            continue;
+        }
+        // pairs with the release of the last reference dropped by paho
+        std::atomic_thread_fence(std::memory_order_acquire);
+        bool recycled = static_cast<bool>(candidate.msg);
+        fill(candidate, topic, payload, qos, retain, msgProps);
+        mqtt::message_ptr msg = candidate.msg;
+        candidate.claimed.store(false, std::memory_order_release);
+        cursor = (cursor + i + 1) % _slots.size();
+        if(recycled){
+            _recycled.fetch_add(1, std::memory_order_relaxed);
+        }
+        return msg;
+    }
+    _messageAllocations.fetch_add(1, std::memory_order_relaxed);
+    return mqtt::make_message(internTopic(topic), mqtt::binary_ref(payload.data(), payload.size()), qos, retain, props);
+}
+
+MessagePool::counters MessagePool::getCounters() const {
+    counters current;
+    current.acquired = _acquired.load(std::memory_order_relaxed);
+    current.recycled = _recycled.load(std::memory_order_relaxed);
+    current.messageAllocations = _messageAllocations.load(std::memory_order_relaxed);
+    current.payloadAllocations = _payloadAllocations.load(std::memory_order_relaxed);
+    current.topicAllocations = _topicAllocations.load(std::memory_order_relaxed);
+    return current;
+}
@@ -1,5 +1,8 @@
 #include "MqttCallbacks.hpp"
 
+#include <algorithm>
+#include <stdexcept>
+
 std::string MqttCallbacks::getTokenTypeStr(mqtt::token::Type type){
     switch(type){
         case mqtt::token::CONNECT:{
@@ -22,7 +25,30 @@ std::string MqttCallbacks::getTokenTypeStr(mqtt::token::Type type){
     }
 }
 
-bool MqttCallbacks::isMqttTopicIncluded(const std::string& topic, const std::string& filter) {
+std::string_view MqttCallbacks::topicFilterOf(std::string_view filter){
+    constexpr std::string_view sharePrefix = "$share/";
+    if(filter.substr(0, sharePrefix.size()) != sharePrefix){
+        return filter;
+    }
+    std::string_view groupAndFilter = filter.substr(sharePrefix.size());
+    size_t groupEnd = groupAndFilter.find('/');
+    if(groupEnd == 0 || groupEnd == std::string_view::npos || groupEnd + 1 == groupAndFilter.size()){
+        throw std::invalid_argument("Shared subscription must be $share/<group>/<filter>: " + std::string(filter));
+    }
+    std::string_view group = groupAndFilter.substr(0, groupEnd);
+    if(group.find_first_of("+#") != std::string_view::npos){
+        throw std::invalid_argument("Share group cannot contain wildcards: " + std::string(filter));
+    }
+    return groupAndFilter.substr(groupEnd + 1);
+}
+
+bool MqttCallbacks::isMqttTopicIncluded(const std::string& topic, const std::string& sharedFilter) {
+    std::string_view filter;
+    try {
+        filter = topicFilterOf(sharedFilter);
+    } catch (const std::invalid_argument& exc) {
+        return false;
+    }
     size_t tlen = topic.length();
     size_t flen = filter.length();
     size_t tidx = 0;
@@ -54,21 +80,134 @@ bool MqttCallbacks::isMqttTopicIncluded(const std::string& topic, const std::str
     return tidx == tlen && fidx == flen;
 }
 
+std::chrono::milliseconds MqttCallbacks::reconnectDelay(int attempt){
+    double delay = static_cast<double>(_reconnectSettings.initialDelay.count());
+    double maxDelay = static_cast<double>(_reconnectSettings.maxDelay.count());
+    for(int i = 0; i < attempt && delay < maxDelay; ++i){
+        delay *= _reconnectSettings.multiplier;
+    }
+    if(delay > maxDelay){
+        delay = maxDelay;
+    }
+    std::uniform_real_distribution<double> random(0.0, 1.0);
+    delay -= delay * _reconnectSettings.jitter * random(_jitterRandom);
+    return std::chrono::milliseconds(static_cast<int64_t>(delay));
+}
+
+void MqttCallbacks::scheduleReconnect(){
+    std::lock_guard<std::mutex> lock(_reconnectMutex);
+    if(!_reconnectSettings.enabled || !_reconnectEnabled || _stopReconnect || _reconnectAt){
+        return;
+    }
+    _reconnectAt = std::chrono::steady_clock::now() + reconnectDelay(_reconnectAttempt++);
+    if(!_reconnectThread.joinable()){
+        _reconnectThread = std::thread(&MqttCallbacks::reconnectLoop, this);
+    }
+    _reconnectCondition.notify_all();
+}
+
+void MqttCallbacks::reconnectLoop(){
+    std::unique_lock<std::mutex> lock(_reconnectMutex);
+    while(true){
+        _reconnectCondition.wait(lock, [this] { return _stopReconnect || _reconnectAt; });
+        if(_stopReconnect){
+            return;
+        }
+        std::chrono::steady_clock::time_point at = *_reconnectAt;
+        // woken early when stopping, or when the attempt was cancelled
+        if(_reconnectCondition.wait_until(lock, at, [this, at] { return _stopReconnect || _reconnectAt != at; })){
+            continue;
+        }
+        _reconnectAt.reset();
+        lock.unlock();
+        reconnect();
+        lock.lock();
+    }
+}
+
 void MqttCallbacks::reconnect() {
-    std::this_thread::sleep_for(std::chrono::milliseconds(5000));
+    if(_mqttClient.is_connected()){
+        return;
+    }
     try {
-        _mqttClient.reconnect();
+        // the outcome comes back through on_success/on_failure
+        _mqttClient.connect(_connOpts, nullptr, *this);
     } catch (const mqtt::exception& exc) {
         std::cerr << "Error: " << exc.what() << std::endl;
+        scheduleReconnect();
     }
 }
 
+void MqttCallbacks::resubscribe(){
+    size_t batchSize;
+    {
+        // reconnection() may change the settings meanwhile
+        std::lock_guard<std::mutex> lock(_reconnectMutex);
+        batchSize = _reconnectSettings.subscribeBatchSize > 0 ? _reconnectSettings.subscribeBatchSize : 1;
+    }
+    std::vector<std::string> topicFilters;
+    std::vector<int> qos;
+    std::vector<mqtt::subscribe_options> options;
+    auto flush = [&] {
+        if(topicFilters.empty()){
+            return;
+        }
+        _mqttClient.subscribe(mqtt::string_collection::create(std::move(topicFilters)), qos, nullptr, *this, options);
+        topicFilters.clear();
+        qos.clear();
+        options.clear();
+    };
+    {
+        EpochReclaimer::guard reading(_handlersReclaimer);
+        const handlerTable& table = *_handlers.load(std::memory_order_acquire);
+        for(const auto& messageHandler : table.handlers){
+            topicFilters.push_back(messageHandler->topicFilter);
+            qos.push_back(messageHandler->settings.qos);
+            options.push_back(messageHandler->settings.options);
+            if(topicFilters.size() == batchSize){
+                flush();
+            }
+        }
+        for(const auto& cachedFilter : table.cachedFilters){
+            topicFilters.push_back(cachedFilter.first);
+            qos.push_back(cachedFilter.second);
+            options.push_back(mqtt::subscribe_options());
+            if(topicFilters.size() == batchSize){
+                flush();
+            }
+        }
+    }
+    if(_requestsEnabled.load(std::memory_order_acquire)){
+        topicFilters.push_back(_responseTopic);
+        qos.push_back(0);
+        options.push_back(mqtt::subscribe_options());
+    }
+    flush();
+}
+
 void MqttCallbacks::on_failure(const mqtt::token& tok) {
     //std::cout << "Action failed for MQTT client " << _mqttClient.get_client_id() << ": " << getTokenTypeStr(tok.get_type()) << std::endl;
+    _metrics.actionFailed();
+    if(tok.get_type() == mqtt::token::CONNECT){
+        scheduleReconnect();
+    }
 }
 
 void MqttCallbacks::on_success(const mqtt::token& tok) {
     //std::cout << "Action succeeded for MQTT client " << _mqttClient.get_client_id() << ": " << getTokenTypeStr(tok.get_type()) << std::endl;
+    if(tok.get_type() == mqtt::token::CONNECT){
+        connectAcknowledged(tok);
+    }
+}
+
+void MqttCallbacks::connectAcknowledged(const mqtt::token& tok){
+    mqtt::connect_response response = tok.get_connect_response();
+    const mqtt::properties& connack = response.get_properties();
+    uint16_t brokerMaximum = 0;
+    if(connack.contains(mqtt::property::code::TOPIC_ALIAS_MAXIMUM)){
+        brokerMaximum = mqtt::get<uint16_t>(connack, mqtt::property::code::TOPIC_ALIAS_MAXIMUM);
+    }
+    _topicAliases.connected(brokerMaximum);
 }
 
 void MqttCallbacks::delivery_complete(mqtt::delivery_token_ptr tok) {
@@ -82,6 +221,9 @@ void MqttCallbacks::delivery_complete(mqtt::delivery_token_ptr tok) {
             << "Return code: "<< tok->get_return_code() << std::endl; */
         result = PUBLISH_FAILURE;
     }
+    if(_metrics.enabled()){
+        _metrics.publishAcknowledged(tok->get_message_id(), result == PUBLISH_SUCCESS);
+    }
     if(_onPublishResultCallback){
         _onPublishResultCallback(result, tok->get_message_id(), tok->get_message());
     }
@@ -89,8 +231,14 @@ void MqttCallbacks::delivery_complete(mqtt::delivery_token_ptr tok) {
 
 void MqttCallbacks::connected(const std::string& cause) {
     //std::cout << "Connection success for MQTT client " << _mqttClient.get_client_id() << std::endl;
-    for(auto messageHandler : messageHandlers){
-        _mqttClient.subscribe(std::get<0>(messageHandler), 0, nullptr, *this);
+    {
+        std::lock_guard<std::mutex> lock(_reconnectMutex);
+        _reconnectAttempt = 0;
+        _reconnectAt.reset();
+    }
+    resubscribe();
+    if(_connectionStateListener){
+        _connectionStateListener(true);
     }
     if(_onConnectCallback){
         _onConnectCallback();
@@ -102,109 +250,582 @@ void MqttCallbacks::connection_lost(const std::string& cause){
     if (!cause.empty()){
         //std::cout << "Cause: " << cause << std::endl;
     }
+    // aliases die with the connection. Publishes since the socket closed saw the client
+    // disconnected and went unaliased; from here on they carry their topic until the next CONNACK
+    _topicAliases.connected(0);
+    scheduleReconnect();
+    if(_connectionStateListener){
+        _connectionStateListener(false);
+    }
     if(_onDisconnectCallback){
         _onDisconnectCallback();
     }
 }
 
-void MqttCallbacks::messageArrivedHandler(mqtt::const_message_ptr msg){
-    for(auto messageHandler : messageHandlers){
-        if(isMqttTopicIncluded(msg->get_topic(), std::get<0>(messageHandler))){
-            std::string response = std::get<1>(messageHandler)(msg->get_topic(), msg->to_string());
-            mqtt::properties msgProps = msg->get_properties();
-            if(msgProps.contains(mqtt::property::code::RESPONSE_TOPIC)){
-                const mqtt::property& responseTopicProp = msgProps.get(mqtt::property::code::RESPONSE_TOPIC);
-                const std::string& responseTopic = mqtt::get<std::string>(responseTopicProp);
-                _mqttClient.publish(responseTopic, response);
+size_t MqttCallbacks::messageArrivedHandler(mqtt::const_message_ptr msg, runningHandler& slot){
+    // positions of the matching handlers, reused across messages by each worker thread
+    thread_local std::vector<size_t> matches;
+    // response buffer, keeps its capacity across messages
+    thread_local std::string response;
+    // payload decoded by each codec of the typed handlers, for this message only
+    thread_local DecodedPayloads decoded;
+    // the table and its handlers stay while this worker reads them
+    EpochReclaimer::guard reading(_handlersReclaimer);
+    const handlerTable& table = *_handlers.load(std::memory_order_acquire);
+    matches.clear();
+    table.index.match(msg->get_topic(), matches);
+    if(matches.empty()){
+        return 0;
+    }
+    // handlers run in registration order when several filters match
+    std::sort(matches.begin(), matches.end());
+    decoded.clear();
+
+    size_t failures = 0;
+    for(size_t handlerIndex : matches){
+        const registeredHandler& matched = *table.handlers[handlerIndex];
+        namedExecutor* executor = matched.executor;
+        if(!executor){
+            if(!runHandler(matched, msg, decoded, response, slot)){
+                ++failures;
             }
+            continue;
+        }
+        // the task may outlive the table, it keeps its handler itself. Decoded values stay
+        // with this thread, the executor decodes its own
+        std::shared_ptr<const registeredHandler> kept = table.handlers[handlerIndex];
+        bool posted = executor->executor->tryPost([this, executor, kept, msg](size_t threadIndex){
+            thread_local std::string executorResponse;
+            thread_local DecodedPayloads executorDecoded;
+            executorDecoded.clear();
+            runHandler(*kept, msg, executorDecoded, executorResponse, *executor->slots[threadIndex]);
+        });
+        if(!posted){
+            reportHandlerError({HANDLER_REJECTED, matched.topicFilter, msg->get_topic(), nullptr, std::chrono::nanoseconds(0)});
+        }
+    }
+    return failures;
+}
+
+void MqttCallbacks::inlineHandlers(const mqtt::const_message_ptr& msg){
+    thread_local std::vector<size_t> matches;
+    thread_local std::string response;
+    thread_local DecodedPayloads decoded;
+    EpochReclaimer::guard reading(_handlersReclaimer);
+    const handlerTable& table = *_handlers.load(std::memory_order_acquire);
+    matches.clear();
+    table.inlineIndex.match(msg->get_topic(), matches);
+    if(matches.empty()){
+        return;
+    }
+    std::sort(matches.begin(), matches.end());
+    decoded.clear();
+    for(size_t handlerIndex : matches){
+        runHandler(*table.handlers[handlerIndex], msg, decoded, response, *_inlineSlot);
+    }
+}
+
+bool MqttCallbacks::runHandler(const registeredHandler& messageHandler, const mqtt::const_message_ptr& msg, DecodedPayloads& decoded, std::string& response, runningHandler& slot){
+    MqttMetrics::filterStats* stats = messageHandler.stats.get();
+    std::chrono::milliseconds deadline = messageHandler.settings.deadline;
+    bool timed = _metrics.enabled();
+    bool watched = deadline.count() > 0;
+    int64_t startedAt = (timed || watched) ? MqttMetrics::now() : 0;
+    uint64_t runId = 0;
+    if(watched){
+        {
+            std::lock_guard<std::mutex> handlerLock(slot.handlerMutex);
+            slot.handler = messageHandler.stats;
+        }
+        slot.startedAt.store(startedAt, std::memory_order_relaxed);
+        runId = slot.runId.fetch_add(1, std::memory_order_relaxed) + 1;
+        slot.deadlineAt.store(startedAt + std::chrono::duration_cast<std::chrono::nanoseconds>(deadline).count(), std::memory_order_release);
+    }
+
+    response.clear();
+    std::exception_ptr exception;
+    try {
+        messageHandler.handler(msg->get_topic(), msg->get_payload(), decoded, response);
+    } catch (...) {
+        exception = std::current_exception();
+    }
+
+    int64_t finishedAt = 0;
+    if(timed || watched){
+        finishedAt = MqttMetrics::now();
+    }
+    if(timed){
+        stats->record(static_cast<uint64_t>(finishedAt - startedAt));
+    }
+    std::chrono::nanoseconds elapsed(finishedAt - startedAt);
+    if(watched){
+        slot.deadlineAt.store(0, std::memory_order_release);
+        {
+            // the stats go with the last handler of their filter, not with the slot
+            std::lock_guard<std::mutex> handlerLock(slot.handlerMutex);
+            slot.handler.reset();
+        }
+        // an overrun shorter than the watchdog period is caught here, whoever comes first reports it
+        if(elapsed > deadline && slot.reportedRunId.exchange(runId, std::memory_order_acq_rel) != runId){
+            reportHandlerError({HANDLER_TIMEOUT, stats->filter(), msg->get_topic(), nullptr, elapsed});
+        }
+    }
+    if(exception){
+        reportHandlerError({HANDLER_EXCEPTION, stats->filter(), msg->get_topic(), exception, elapsed});
+        return false;
+    }
+
+    const mqtt::properties& msgProps = msg->get_properties();
+    if(msgProps.contains(mqtt::property::code::RESPONSE_TOPIC)){
+        mqtt::properties responseProps;
+        // the requester matches the response to its request with the correlation data
+        if(msgProps.contains(mqtt::property::code::CORRELATION_DATA)){
+            responseProps.add(msgProps.get(mqtt::property::code::CORRELATION_DATA));
+        }
+        // paho refuses it while disconnected, past its buffer or for a bad response topic,
+        // which must not take down the thread running handlers
+        try {
+            _mqttClient.publish(_messagePool.acquire(mqtt::get<std::string>(msgProps, mqtt::property::code::RESPONSE_TOPIC), response, 0, false, responseProps));
+        } catch (const std::exception& exc) {
+            _metrics.actionFailed();
+            reportHandlerError({HANDLER_RESPONSE_FAILED, stats->filter(), msg->get_topic(), std::current_exception(), elapsed});
+        }
+    }
+    return true;
+}
+
+void MqttCallbacks::reportHandlerError(handlerError error){
+    if(!_onHandlerErrorCallback){
+        return;
+    }
+    // the callback must not take its own failure down to the thread running handlers
+    try {
+        _onHandlerErrorCallback(error);
+    } catch (...) {
+    }
+}
+
+MqttCallbacks::runningHandler* MqttCallbacks::addRunningSlot(){
+    std::lock_guard<std::mutex> lock(_runningMutex);
+    _running.emplace_back();
+    return &_running.back();
+}
+
+void MqttCallbacks::watchdogLoop(){
+    constexpr std::chrono::milliseconds period{10};
+    std::unique_lock<std::mutex> lock(_watchdogMutex);
+    while(!_watchdogCondition.wait_for(lock, period, [this] { return _stopWatchdog; })){
+        lock.unlock();
+        int64_t now = MqttMetrics::now();
+        std::vector<handlerError> overruns;
+        {
+            std::lock_guard<std::mutex> runningLock(_runningMutex);
+            for(runningHandler& slot : _running){
+                int64_t deadlineAt = slot.deadlineAt.load(std::memory_order_acquire);
+                if(deadlineAt == 0 || now <= deadlineAt){
+                    continue;
+                }
+                uint64_t runId = slot.runId.load(std::memory_order_relaxed);
+                std::shared_ptr<MqttMetrics::filterStats> stats;
+                {
+                    std::lock_guard<std::mutex> handlerLock(slot.handlerMutex);
+                    stats = slot.handler;
+                }
+                int64_t startedAt = slot.startedAt.load(std::memory_order_relaxed);
+                // the handler returned, or another one started, while reading the slot
+                if(!stats || slot.deadlineAt.load(std::memory_order_acquire) != deadlineAt){
+                    continue;
+                }
+                if(slot.reportedRunId.exchange(runId, std::memory_order_acq_rel) != runId){
+                    // the topic of a running message is not tracked, only its filter
+                    overruns.push_back({HANDLER_TIMEOUT, stats->filter(), "", nullptr, std::chrono::nanoseconds(now - startedAt)});
+                }
+            }
+        }
+        for(handlerError& overrun : overruns){
+            reportHandlerError(std::move(overrun));
+        }
+        lock.lock();
+    }
+}
+
+// Makes room in a full queue by discarding its oldest message. Only the shared queue can
+// be popped from the producer side, returns false for the ordered shards
+template <typename T>
+static bool dropOldest(MpmcQueue<T>& queue, std::atomic<uint64_t>& droppedMessages){
+    T oldest;
+    if(queue.tryPop(oldest)){
+        droppedMessages.fetch_add(1, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+template <typename T>
+static bool dropOldest(SpscQueue<T>& queue, std::atomic<uint64_t>& droppedMessages){
+    return false;
+}
+
+template <typename Queue>
+bool MqttCallbacks::push(Queue& queue, queuedMessage& item) {
+    switch(_dispatchSettings.backpressure){
+        case BACKPRESSURE_DROP_NEWEST:{
+            if(!queue.tryPush(std::move(item))){
+                _droppedMessages.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            return true;
+        }
+        case BACKPRESSURE_DROP_OLDEST:{
+            while(!queue.tryPush(std::move(item))){
+                if(!dropOldest(queue, _droppedMessages)){
+                    _droppedMessages.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+            }
+            return true;
+        }
+        default:{
+            int spins = 0;
+            while(!queue.tryPush(std::move(item))){
+                if(spins < _dispatchSettings.spinCount){
+                    ++spins;
+                    std::this_thread::yield();
+                    continue;
+                }
+                uint64_t epoch = _queueNotFull.prepareWait();
+                if(queue.tryPush(std::move(item))){
+                    _queueNotFull.cancelWait();
+                    break;
+                }
+                if(stopExecution){
+                    _queueNotFull.cancelWait();
+                    return false;
+                }
+                _queueNotFull.commitWait(epoch);
+            }
+            return true;
         }
     }
 }
 
 // Enqueue task for execution by the thread pool 
 void MqttCallbacks::enqueue(mqtt::const_message_ptr msg) {
-    {
-        std::unique_lock<std::mutex> lock(queueMutex); 
-        msgQueue.emplace(std::move(msg)); 
+    queuedMessage item{std::move(msg), _metrics.enabled() ? MqttMetrics::now() : 0};
+    if(_dispatchSettings.mode != DISPATCH_ORDERED){
+        if(push(*msgQueue, item)){
+            _queueNotEmpty.notifyOne();
+        }
+        return;
+    }
+
+    std::string_view key = _dispatchSettings.orderingKey ? _dispatchSettings.orderingKey(item.msg) : std::string_view(item.msg->get_topic());
+    if(!key.empty()){
+        orderedShard& shard = *_orderedShards[std::hash<std::string_view>()(key) % _orderedShards.size()];
+        if(push(shard.msgQueue, item)){
+            shard.notEmpty.notifyOne();
+        }
+        return;
+    }
+
+    // no ordering needed: wake the first parked worker, busy ones check the shared queue before parking
+    if(push(*msgQueue, item)){
+        for(size_t i = 0; i < _orderedShards.size(); ++i){
+            if(_orderedShards[(_nextWakeup + i) % _orderedShards.size()]->notEmpty.notifyOne()){
+                _nextWakeup = (_nextWakeup + i + 1) % _orderedShards.size();
+                break;
+            }
+        }
+    }
+}
+
+bool MqttCallbacks::tryDequeue(size_t workerIndex, queuedMessage& item) {
+    bool dequeued = (!_orderedShards.empty() && _orderedShards[workerIndex]->msgQueue.tryPop(item)) || msgQueue->tryPop(item);
+    if(dequeued && _dispatchSettings.backpressure == BACKPRESSURE_BLOCK){
+        _queueNotFull.notifyOne();
+    }
+    return dequeued;
+}
+
+bool MqttCallbacks::dequeue(size_t workerIndex, queuedMessage& item) {
+    Parker& notEmpty = _orderedShards.empty() ? _queueNotEmpty : _orderedShards[workerIndex]->notEmpty;
+    while(true){
+        for(int spins = 0; spins < _dispatchSettings.spinCount; ++spins){
+            if(tryDequeue(workerIndex, item)){
+                return true;
+            }
+            // spin on the first half, then give the core away between polls
+            if(spins >= _dispatchSettings.spinCount / 2){
+                std::this_thread::yield();
+            }
+        }
+        uint64_t epoch = notEmpty.prepareWait();
+        if(tryDequeue(workerIndex, item)){
+            notEmpty.cancelWait();
+            return true;
+        }
+        // exit the thread in case the pool 
+        // is stopped and there are no tasks 
+        if(stopExecution){
+            notEmpty.cancelWait();
+            return false;
+        }
+        notEmpty.commitWait(epoch);
     }
-    conditionVariable.notify_one(); 
 }
 
 void MqttCallbacks::message_arrived(mqtt::const_message_ptr msg){
     //std::cout << "Message arrived from broker" << std::endl;
     //std::cout << "topic: '" << msg->get_topic() << "'" << std::endl;
     //std::cout << "payload: '" << msg->to_string() << std::endl;
+    startWorkers();
+    _metrics.messageReceived();
+    if(_topicAliases.getSettings().maxInbound != 0){
+        msg = _topicAliases.resolve(std::move(msg));
+        if(!msg){
+            return;
+        }
+    }
+    // inflated once, ahead of the cache, the responses and every handler
+    msg = inflate(std::move(msg));
+    if(!msg){
+        return;
+    }
+    // responses to our own requests skip the handlers
+    if(_requestsEnabled.load(std::memory_order_acquire) && msg->get_topic() == _responseTopic){
+        _requestTracker.complete(std::move(msg));
+        return;
+    }
+    if(_hasCachedFilters.load(std::memory_order_acquire)){
+        bool cached = false;
+        {
+            EpochReclaimer::guard reading(_handlersReclaimer);
+            _handlers.load(std::memory_order_acquire)->cachedIndex.forEachMatch(msg->get_topic(), [&cached](int qos){
+                cached = true;
+            });
+        }
+        if(cached){
+            _lastValues.update(msg);
+        }
+    }
+    if(_hasInlineHandlers.load(std::memory_order_acquire)){
+        inlineHandlers(msg);
+    }
     enqueue(msg);
 }
 
-MqttCallbacks::MqttCallbacks(mqtt::async_client& mqttClient, mqtt::connect_options& connOpts, int numRcvHandlerTasks)
-    : _mqttClient(mqttClient), _connOpts(connOpts) {
-        for (size_t i = 0; i < numRcvHandlerTasks; ++i) { 
-            rcvHandlersThreads.emplace_back([this, i] { 
-                while (true) { 
-                    mqtt::const_message_ptr msg; 
-                    // The reason for putting the below code 
-                    // here is to unlock the queue before 
-                    // executing the task so that other 
-                    // threads can perform enqueue tasks 
-                    {
-                        // Locking the queue so that data 
-                        // can be shared safely 
-                        std::unique_lock<std::mutex> lock(queueMutex); 
-
-                        // Waiting until there is a task to 
-                        // execute or the pool is stopped 
-                        conditionVariable.wait(lock, [this] { 
-                            return !msgQueue.empty() || stopExecution; 
-                        }); 
-
-                        // exit the thread in case the pool 
-                        // is stopped and there are no tasks 
-                        if (stopExecution && msgQueue.empty()) { 
-                            return; 
-                        } 
-
-                        // Get the next msg from the queue 
-                        msg = move(msgQueue.front()); 
-                        msgQueue.pop(); 
-                    }
-
-                    // std::cout << "Received msg on topic " << msg->get_topic() << "(worker thread " << i  << ")" <<std::endl;
-                    try{
-                        for(auto messageHandler : messageHandlers){
-                            if(isMqttTopicIncluded(msg->get_topic(), std::get<0>(messageHandler))){
-                                std::string response = std::get<1>(messageHandler)(msg->get_topic(), msg->to_string());
-                                mqtt::properties msgProps = msg->get_properties();
-                                if(msgProps.contains(mqtt::property::code::RESPONSE_TOPIC)){
-                                    const mqtt::property& responseTopicProp = msgProps.get(mqtt::property::code::RESPONSE_TOPIC);
-                                    const std::string& responseTopic = mqtt::get<std::string>(responseTopicProp);
-                                    _mqttClient.publish(responseTopic, response);
-                                }
-                            }
-                        }
-                    } catch( std::exception& exc){
-
-                    }
-                } 
-            }); 
+mqtt::const_message_ptr MqttCallbacks::inflate(mqtt::const_message_ptr msg){
+    if(!_compression.inflates() || !msg->get_properties().contains(mqtt::property::code::USER_PROPERTY)){
+        return msg;
+    }
+    thread_local std::string inflated;
+    mqtt::properties props;
+    try {
+        if(!_compression.decompress(*msg, inflated, props)){
+            return msg;
+        }
+    } catch (const std::runtime_error& exc) {
+        reportHandlerError({HANDLER_INFLATE_FAILED, std::string(), msg->get_topic(), std::current_exception()});
+        return nullptr;
+    }
+    return _inflatedMessages.acquire(msg->get_topic(), inflated, msg->get_qos(), msg->is_retained(), props);
+}
+
+void MqttCallbacks::workerLoop(size_t workerIndex){
+    runningHandler& slot = *addRunningSlot();
+    queuedMessage item; 
+    while(dequeue(workerIndex, item)){
+        // std::cout << "Received msg on topic " << item.msg->get_topic() << "(worker thread " << workerIndex  << ")" <<std::endl;
+        bool timed = _metrics.enabled();
+        int64_t startedAt = timed ? MqttMetrics::now() : 0;
+        // each handler catches its own exceptions, one failing does not skip the others
+        for(size_t failures = messageArrivedHandler(item.msg, slot); failures > 0; --failures){
+            _metrics.handlerError(workerIndex);
+        }
+        if(timed){
+            _metrics.messageHandled(workerIndex, item.enqueuedAt, startedAt, MqttMetrics::now());
         }
+        item.msg.reset();
+    }
+}
+
+MqttCallbacks::MqttCallbacks(mqtt::async_client& mqttClient, mqtt::connect_options& connOpts, int numRcvHandlerTasks)
+    : _mqttClient(mqttClient), _connOpts(connOpts), _metrics(mqttClient.get_client_id()) {
+        _dispatchSettings.numWorkers = numRcvHandlerTasks;
+        _inlineSlot = addRunningSlot();
+        _metrics.setGauges([this](MqttMetrics::snapshot& current){
+            current.dropped = _droppedMessages.load(std::memory_order_relaxed);
+            current.pendingRequests = _requestTracker.pending();
+            // the queues are built by the first message, on another thread
+            if(!_workersReady.load(std::memory_order_acquire)){
+                return;
+            }
+            current.queueDepth = msgQueue->size();
+            for(const auto& shard : _orderedShards){
+                current.queueDepth += shard->msgQueue.size();
+            }
+        });
     }
 
 MqttCallbacks::~MqttCallbacks(){
+    // the metrics dump thread outlives the queues and the request tracker the gauges read
+    _metrics.setGauges(nullptr);
     {
-        // Lock the queue to update the stop flag safely 
-        std::unique_lock<std::mutex> lock(queueMutex); 
-        stopExecution = true; 
+        std::lock_guard<std::mutex> lock(_reconnectMutex);
+        _stopReconnect = true;
     }
+    _reconnectCondition.notify_all();
+    if(_reconnectThread.joinable()){
+        _reconnectThread.join();
+    }
+
+    stopExecution = true; 
 
-    // Notify all threads 
-    conditionVariable.notify_all(); 
+    // Notify all threads, including a producer blocked on a full queue
+    _queueNotEmpty.notifyAll(); 
+    _queueNotFull.notifyAll();
+    for (auto& shard : _orderedShards) {
+        shard->notEmpty.notifyAll();
+    }
 
     // Joining all worker threads to ensure they have 
     // completed their tasks 
     for (auto& thread : rcvHandlersThreads) { 
         thread.join(); 
     } 
+
+    // the executors run what the workers handed them before the handlers go away
+    _executors.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(_watchdogMutex);
+        _stopWatchdog = true;
+    }
+    _watchdogCondition.notify_all();
+    if(_watchdogThread.joinable()){
+        _watchdogThread.join();
+    }
+
+    // nothing dispatches anymore, the retired tables go with _handlersReclaimer
+    delete _handlers.load(std::memory_order_relaxed);
+}
+
+void MqttCallbacks::dispatch(dispatchSettings settings){
+    _dispatchSettings = settings;
+}
+
+void MqttCallbacks::reconnection(reconnectSettings settings){
+    std::lock_guard<std::mutex> lock(_reconnectMutex);
+    _reconnectSettings = settings;
+}
+
+void MqttCallbacks::setReconnectEnabled(bool enabled){
+    {
+        std::lock_guard<std::mutex> lock(_reconnectMutex);
+        _reconnectEnabled = enabled;
+        if(!enabled){
+            _reconnectAt.reset();
+            _reconnectAttempt = 0;
+        }
+    }
+    _reconnectCondition.notify_all();
+}
+
+void MqttCallbacks::startWorkers(){
+    std::call_once(_workersStarted, [this] {
+        _metrics.setWorkers(_dispatchSettings.numWorkers);
+        msgQueue = std::make_unique<MpmcQueue<queuedMessage>>(_dispatchSettings.queueCapacity);
+        if(_dispatchSettings.mode == DISPATCH_ORDERED){
+            for (int i = 0; i < _dispatchSettings.numWorkers; ++i) { 
+                _orderedShards.push_back(std::make_unique<orderedShard>(_dispatchSettings.queueCapacity));
+            }
+        }
+        _workersReady.store(true, std::memory_order_release);
+        for (int i = 0; i < _dispatchSettings.numWorkers; ++i) { 
+            rcvHandlersThreads.emplace_back(&MqttCallbacks::workerLoop, this, i); 
+        }
+    });
+}
+
+uint64_t MqttCallbacks::droppedMessages() const {
+    return _droppedMessages.load(std::memory_order_relaxed);
+}
+
+void MqttCallbacks::addExecutor(const std::string& name, int numThreads, size_t queueCapacity){
+    if(name.empty() || name == "inline"){
+        throw std::invalid_argument("Executor name is reserved: '" + name + "'");
+    }
+    if(numThreads <= 0){
+        throw std::invalid_argument("Executor needs at least one thread: " + name);
+    }
+    if(_executors.count(name)){
+        throw std::invalid_argument("Executor already added: " + name);
+    }
+    namedExecutor& added = _executors[name];
+    for(int i = 0; i < numThreads; ++i){
+        added.slots.push_back(addRunningSlot());
+    }
+    added.executor = std::make_unique<HandlerExecutor>(name, numThreads, queueCapacity);
+}
+
+MessagePool& MqttCallbacks::messagePool(){
+    return _messagePool;
+}
+
+MqttMetrics& MqttCallbacks::metrics(){
+    return _metrics;
+}
+
+TopicAliases& MqttCallbacks::topicAliases(){
+    return _topicAliases;
+}
+
+void MqttCallbacks::cache(std::string topicFilter, int qos){
+    {
+        std::lock_guard<std::mutex> lock(_handlersMutex);
+        for(const auto& cachedFilter : _handlers.load(std::memory_order_relaxed)->cachedFilters){
+            // raising the qos resubscribes, as on does for a handler
+            if(cachedFilter.first == topicFilter && cachedFilter.second >= qos){
+                return;
+            }
+        }
+        std::pair<std::string, int> added(topicFilter, qos);
+        replaceHandlers([](const registeredHandler& kept){
+            return true;
+        }, nullptr, &added);
+    }
+    if(_mqttClient.is_connected()){
+        _mqttClient.subscribe(topicFilter, qos, nullptr, *this, mqtt::subscribe_options());
+    }
+}
+
+PayloadCompression& MqttCallbacks::compression(){
+    return _compression;
+}
+
+LastValueCache& MqttCallbacks::lastValues(){
+    return _lastValues;
+}
+
+std::future<mqtt::const_message_ptr> MqttCallbacks::request(const std::string& topic, const std::string& payload, std::chrono::milliseconds timeout, int qos){
+    std::call_once(_responseTopicSubscribed, [this] {
+        _responseTopic = _mqttClient.get_client_id() + "/rpc/responses";
+        _requestsEnabled.store(true, std::memory_order_release);
+        if(_mqttClient.is_connected()){
+            _mqttClient.subscribe(_responseTopic, 0, nullptr, *this);
+        }
+    });
+    std::string correlationData;
+    std::future<mqtt::const_message_ptr> response = _requestTracker.add(timeout, correlationData);
+    mqtt::properties requestProps {
+        mqtt::property(mqtt::property::code::RESPONSE_TOPIC, _responseTopic),
+        mqtt::property(mqtt::property::code::CORRELATION_DATA, correlationData)
+    };
+    try {
+        _mqttClient.publish(_messagePool.acquire(topic, payload, qos, false, requestProps), nullptr, *this);
+    } catch (const mqtt::exception& exc) {
+        _requestTracker.fail(correlationData, std::current_exception());
+    }
+    return response;
 }
 
 void MqttCallbacks::onConnect(std::function<void()> onConnectCallback){
@@ -215,18 +836,168 @@ void MqttCallbacks::onDisconnect(std::function<void()> onDisconnectCallback){
     _onDisconnectCallback = onDisconnectCallback;
 }
 
+void MqttCallbacks::setConnectionStateListener(std::function<void(bool connected)> listener){
+    _connectionStateListener = listener;
+}
+
 void MqttCallbacks::onPublishResult(std::function<void(PublishResult result, int messageId,  mqtt::const_message_ptr msg)> onPublishResultCallback){
     _onPublishResultCallback = onPublishResultCallback;
 }
 
-void MqttCallbacks::on(std::string topicFilter, std::function<std::string(std::string topic, std::string payload)> messageHandler){
-    for(auto messageHandler : messageHandlers){
-        if(std::get<0>(messageHandler) == topicFilter){
-            return;
+void MqttCallbacks::onHandlerError(std::function<void(const handlerError& error)> onHandlerErrorCallback){
+    _onHandlerErrorCallback = onHandlerErrorCallback;
+}
+
+void MqttCallbacks::publishDiscarded(PublishResult result, const std::string& topic, const std::string& payload, int qos, bool retain){
+    if(_onPublishResultCallback){
+        _onPublishResultCallback(result, 0, mqtt::make_message(topic, payload, qos, retain));
+    }
+}
+
+void MqttCallbacks::publishBatchCompleted(PublishResult result){
+    if(_onPublishResultCallback){
+        _onPublishResultCallback(result, 0, nullptr);
+    }
+}
+
+void MqttCallbacks::on(std::string topicFilter, std::function<std::string(std::string topic, std::string payload)> messageHandler, int qos){
+    subscriptionSettings settings;
+    settings.qos = qos;
+    on(topicFilter, messageHandler, settings);
+}
+
+void MqttCallbacks::on(std::string topicFilter, messageViewHandler messageHandler, int qos){
+    subscriptionSettings settings;
+    settings.qos = qos;
+    on(topicFilter, std::move(messageHandler), settings);
+}
+
+void MqttCallbacks::on(std::string topicFilter, std::function<std::string(std::string topic, std::string payload)> messageHandler, subscriptionSettings settings){
+    addHandler(topicFilter, [messageHandler](std::string_view topic, std::string_view payload, DecodedPayloads& decoded, std::string& response){
+        response = messageHandler(std::string(topic), std::string(payload));
+    }, settings);
+}
+
+void MqttCallbacks::on(std::string topicFilter, messageViewHandler messageHandler, subscriptionSettings settings){
+    addHandler(topicFilter, [messageHandler](std::string_view topic, std::string_view payload, DecodedPayloads& decoded, std::string& response){
+        messageHandler(topic, payload, response);
+    }, settings);
+}
+
+template <typename Keep>
+void MqttCallbacks::replaceHandlers(Keep keep, std::shared_ptr<const registeredHandler> added, const std::pair<std::string, int>* addedCache){
+    handlerTable* current = _handlers.load(std::memory_order_relaxed);
+    auto next = std::make_unique<handlerTable>();
+    auto index = [&next](const std::shared_ptr<const registeredHandler>& kept){
+        // delivered messages carry the plain topic, so the indexes hold the filter part only
+        std::string matchedFilter(topicFilterOf(kept->topicFilter));
+        (kept->settings.executor == "inline" ? next->inlineIndex : next->index).insert(matchedFilter, next->handlers.size());
+        next->handlers.push_back(kept);
+    };
+    for(const auto& kept : current->handlers){
+        if(keep(*kept)){
+            index(kept);
+        }
+    }
+    if(added){
+        index(added);
+    }
+    auto indexCache = [&next](const std::pair<std::string, int>& cachedFilter){
+        next->cachedIndex.insert(std::string(topicFilterOf(cachedFilter.first)), cachedFilter.second);
+        next->cachedFilters.push_back(cachedFilter);
+    };
+    for(const auto& cachedFilter : current->cachedFilters){
+        // addedCache replaces the entry of its filter
+        if(!addedCache || cachedFilter.first != addedCache->first){
+            indexCache(cachedFilter);
+        }
+    }
+    if(addedCache){
+        indexCache(*addedCache);
+    }
+    _hasInlineHandlers.store(!next->inlineIndex.empty(), std::memory_order_release);
+    _hasCachedFilters.store(!next->cachedIndex.empty(), std::memory_order_release);
+    _handlers.store(next.release(), std::memory_order_release);
+    _handlersReclaimer.retire([current] { delete current; });
+}
+
+void MqttCallbacks::addHandler(std::string topicFilter, dispatchHandler messageHandler, subscriptionSettings settings){
+    if(!settings.shareGroup.empty()){
+        topicFilter = "$share/" + settings.shareGroup + "/" + topicFilter;
+    }
+    bool isInline = settings.executor == "inline";
+    namedExecutor* executor = nullptr;
+    if(!settings.executor.empty() && !isInline){
+        auto found = _executors.find(settings.executor);
+        if(found == _executors.end()){
+            throw std::invalid_argument("Unknown executor: " + settings.executor);
+        }
+        executor = &found->second;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_handlersMutex);
+        for(const auto& registered : _handlers.load(std::memory_order_relaxed)->handlers){
+            if(registered->topicFilter == topicFilter){
+                return;
+            }
+        }
+        auto added = std::make_shared<const registeredHandler>(registeredHandler{
+            topicFilter, std::move(messageHandler), _metrics.registerFilter(topicFilter), settings, executor});
+        replaceHandlers([](const registeredHandler& kept){
+            return true;
+        }, std::move(added));
+    }
+    if(settings.deadline.count() > 0){
+        std::call_once(_watchdogStarted, [this] {
+            _watchdogThread = std::thread(&MqttCallbacks::watchdogLoop, this);
+        });
+    }
+    if(_mqttClient.is_connected()){
+        _mqttClient.subscribe(topicFilter, settings.qos, nullptr, *this, settings.options);
+    }
+}
+
+bool MqttCallbacks::off(const std::string& topicFilter, const std::string& shareGroup){
+    std::string subscribedFilter = shareGroup.empty() ? topicFilter : "$share/" + shareGroup + "/" + topicFilter;
+    std::lock_guard<std::mutex> lock(_handlersMutex);
+    bool found = false;
+    for(const auto& registered : _handlers.load(std::memory_order_relaxed)->handlers){
+        found = found || registered->topicFilter == subscribedFilter;
+    }
+    if(!found){
+        return false;
+    }
+    replaceHandlers([&subscribedFilter](const registeredHandler& kept){
+        return kept.topicFilter != subscribedFilter;
+    }, nullptr);
+    return true;
+}
+
+bool MqttCallbacks::hasHandler(const std::string& topicFilter, const std::string& shareGroup){
+    std::string subscribedFilter = shareGroup.empty() ? topicFilter : "$share/" + shareGroup + "/" + topicFilter;
+    EpochReclaimer::guard reading(_handlersReclaimer);
+    for(const auto& registered : _handlers.load(std::memory_order_acquire)->handlers){
+        if(registered->topicFilter == subscribedFilter){
+            return true;
+        }
+    }
+    return false;
+}
+
+bool MqttCallbacks::unsubscribe(const std::string& topicFilter, const std::string& shareGroup){
+    bool removed = off(topicFilter, shareGroup);
+    std::string subscribedFilter = shareGroup.empty() ? topicFilter : "$share/" + shareGroup + "/" + topicFilter;
+    // the last-value cache still wants the messages of its own filters
+    {
+        EpochReclaimer::guard reading(_handlersReclaimer);
+        for(const auto& cachedFilter : _handlers.load(std::memory_order_acquire)->cachedFilters){
+            if(cachedFilter.first == subscribedFilter){
+                return removed;
+            }
         }
     }
-    messageHandlers.emplace_back(topicFilter, messageHandler);
     if(_mqttClient.is_connected()){
-        _mqttClient.subscribe(topicFilter, 0, nullptr, *this);
+        _mqttClient.unsubscribe(subscribedFilter, nullptr, *this);
     }
+    return removed;
 }
\ No newline at end of file
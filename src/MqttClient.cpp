@@ -1,5 +1,7 @@
 #include "MqttClient.hpp"
 
+#include "PublishBatch.hpp"
+
 MqttClient::MqttClient(std::string hostAddress, int port, std::string clientId, int mqttVersion, std::string persistDir)
 {
     _createOptionsPtr = std::make_unique<mqtt::create_options>(mqttVersion);
@@ -19,10 +21,30 @@ MqttClient::MqttClient(std::string hostAddress, int port, std::string clientId,
     _connectOptionsPtr->set_clean_start(false);
     _connectOptionsPtr->set_clean_session(false);
     _connectOptionsPtr->set_keep_alive_interval(std::chrono::seconds(10));
-    _connectOptionsPtr->set_automatic_reconnect(true);
+    // reconnection is scheduled by the callbacks, with backoff and jitter
+    _connectOptionsPtr->set_automatic_reconnect(false);
     _pahoMqttClientPtr->set_callback(*_callbacksPtr);
 }
 
+MqttClient::~MqttClient(){
+    // the shaper timer publishes into the log, and the log replays into paho
+    _shaperPtr.reset();
+    {
+        std::lock_guard<std::mutex> lock(_replayMutex);
+        _stopReplay = true;
+    }
+    _replayCondition.notify_all();
+    if(_replayThread.joinable()){
+        _replayThread.join();
+    }
+    // paho completes logged publishes into the log and reports lost connections to it,
+    // so it lets go of them before the log goes away
+    if(_offlineLogPtr){
+        _callbacksPtr->setReconnectEnabled(false);
+        disconnectNow();
+    }
+}
+
 
 MqttClient::MqttClient(std::string hostAddress, int port, std::string clientId, int mqttVersion, std::string persistDir, sslSettings sslParams)
     : MqttClient(hostAddress, port, clientId, mqttVersion, persistDir)
@@ -67,31 +89,455 @@ MqttClient::MqttClient(std::string hostAddress, std::string clientId, int mqttVe
 
 void MqttClient::start(){
     //std::cout << "Connecting " << _clientId << " to MQTT broker " << _hostAddress << std::endl;
+    _callbacksPtr->startWorkers();
+    _callbacksPtr->setReconnectEnabled(true);
     _pahoMqttClientPtr->connect(*_connectOptionsPtr, nullptr, *_callbacksPtr);
 }
 
+void MqttClient::start(mqtt::iaction_listener& listener){
+    _callbacksPtr->startWorkers();
+    _callbacksPtr->setReconnectEnabled(true);
+    _connectListener.forwardTo(listener);
+    _pahoMqttClientPtr->connect(*_connectOptionsPtr, nullptr, _connectListener);
+}
+
+void MqttClient::connectListener::forwardTo(mqtt::iaction_listener& listener){
+    _listener = &listener;
+}
+
+void MqttClient::connectListener::on_success(const mqtt::token& tok){
+    _client._callbacksPtr->connectAcknowledged(tok);
+    _listener->on_success(tok);
+}
+
+void MqttClient::connectListener::on_failure(const mqtt::token& tok){
+    _listener->on_failure(tok);
+}
+
 void MqttClient::finish(){
     //std::cout << "Disconnecting " << _clientId << " from MQTT broker " << _hostAddress << std::endl;
-    if(_pahoMqttClientPtr->is_connected()){
-        _pahoMqttClientPtr->disconnect();
+    _callbacksPtr->setReconnectEnabled(false);
+    // held and batched messages go out before the disconnect
+    if(_shaperPtr){
+        _shaperPtr->flush();
     }
+    // aliases end with the connection, and publishes are not held under stale ones meanwhile.
+    // Inbound ones are reset by connection_lost, on the thread resolving them
+    _callbacksPtr->topicAliases().stopOutbound();
+    // what is still unacknowledged waits on disk for the next start
+    if(_offlineLogPtr){
+        _offlineLogPtr->pause();
+        _offlineLogPtr->sync();
+    }
+    disconnectNow();
     //std::cout << _clientId << " finished disconnecting." << std::endl;
 }
 
-int MqttClient::publish(std::string topic, std::string payload, int qos, bool retain){
-    mqtt::message_ptr msg = mqtt::make_message(topic, payload, qos, retain);
-    mqtt::delivery_token_ptr tok = _pahoMqttClientPtr->publish(msg, nullptr, *_callbacksPtr);
+void MqttClient::disconnectNow(){
+    if(!_pahoMqttClientPtr->is_connected()){
+        return;
+    }
+    try {
+        _pahoMqttClientPtr->disconnect()->wait();
+    } catch (const mqtt::exception& exc) {
+        std::cerr << "Error: " << exc.what() << std::endl;
+    }
+}
+
+int MqttClient::publish(const std::string& topic, const std::string& payload, int qos, bool retain){
+    if(_shaperPtr){
+        return _shaperPtr->publish(topic, payload, qos, retain);
+    }
+    return publishNow(topic, payload, qos, retain);
+}
+
+int MqttClient::publishNow(const std::string& topic, const std::string& payload, int qos, bool retain){
+    if(_offlineLogPtr){
+        // a logged record paho can never accept would be replayed forever
+        if(qos < 0 || qos > 2){
+            throw std::invalid_argument("Invalid qos");
+        }
+        if(topic.empty() || topic.find_first_of("+#") != std::string::npos){
+            throw std::invalid_argument("Invalid publish topic");
+        }
+        OfflineLog::appendResult appended = _offlineLogPtr->append(topic, payload, qos, retain);
+        if(appended.sequence == 0){
+            _callbacksPtr->publishDiscarded(MqttCallbacks::PUBLISH_DROPPED, topic, payload, qos, retain);
+            return 0;
+        }
+        return appended.send ? sendLogged(appended.sequence, false, topic, payload, qos, retain) : 0;
+    }
+    MqttMetrics& metrics = _callbacksPtr->metrics();
+    int64_t startedAt = metrics.enabled() ? MqttMetrics::now() : 0;
+    mqtt::delivery_token_ptr tok = send(topic, payload, qos, retain, nullptr, *_callbacksPtr);
+    if(startedAt != 0){
+        metrics.publishSent(tok->get_message_id(), startedAt);
+    }
     return tok->get_message_id();
 }
 
+int MqttClient::sendLogged(uint64_t sequence, bool replayed, const std::string& topic, std::string_view payload, int qos, bool retain){
+    MqttMetrics& metrics = _callbacksPtr->metrics();
+    int64_t startedAt = metrics.enabled() ? MqttMetrics::now() : 0;
+    auto owned = std::make_unique<loggedSend>(loggedSend{sequence, replayed});
+    loggedSend* context = owned.get();
+    {
+        std::lock_guard<std::mutex> lock(_loggedSendsMutex);
+        _loggedSends.emplace(context, std::move(owned));
+    }
+    try {
+        mqtt::delivery_token_ptr tok = send(topic, payload, qos, retain, context, _offlineLogListener);
+        if(startedAt != 0){
+            metrics.publishSent(tok->get_message_id(), startedAt);
+        }
+        return tok->get_message_id();
+    } catch (const mqtt::exception& exc) {
+        {
+            std::lock_guard<std::mutex> lock(_loggedSendsMutex);
+            _loggedSends.erase(context);
+        }
+        if(!_pahoMqttClientPtr->is_connected()){
+            // the record stays in the log, sent again after the next connection
+            _offlineLogPtr->pause();
+        } else {
+            // refused while connected, replaying it would only be refused again
+            _offlineLogPtr->acknowledge(sequence);
+            _callbacksPtr->publishDiscarded(MqttCallbacks::PUBLISH_FAILURE, topic, std::string(payload), qos, retain);
+        }
+        if(replayed){
+            {
+                std::lock_guard<std::mutex> lock(_replayMutex);
+                --_replayInFlight;
+            }
+            _replayCondition.notify_all();
+        }
+        return 0;
+    }
+}
+
+void MqttClient::offlineLogListener::on_success(const mqtt::token& tok){
+    _client.logCompleted(tok, true);
+}
+
+void MqttClient::offlineLogListener::on_failure(const mqtt::token& tok){
+    _client.logCompleted(tok, false);
+}
+
+void MqttClient::logCompleted(const mqtt::token& tok, bool success){
+    std::unique_ptr<loggedSend> context;
+    {
+        std::lock_guard<std::mutex> lock(_loggedSendsMutex);
+        auto found = _loggedSends.find(static_cast<const loggedSend*>(tok.get_user_context()));
+        if(found == _loggedSends.end()){
+            return;
+        }
+        context = std::move(found->second);
+        _loggedSends.erase(found);
+    }
+    // a failed publish stays in the log for the next replay
+    if(success){
+        _offlineLogPtr->acknowledge(context->sequence);
+    } else {
+        _callbacksPtr->metrics().actionFailed();
+    }
+    if(context->replayed){
+        {
+            std::lock_guard<std::mutex> lock(_replayMutex);
+            --_replayInFlight;
+        }
+        _replayCondition.notify_all();
+    }
+}
+
+void MqttClient::replayLoop(){
+    // topic copy for the message pool, reused across records
+    std::string topic;
+    std::unique_lock<std::mutex> lock(_replayMutex);
+    while(true){
+        _replayCondition.wait(lock, [this] { return _replayRequested || _stopReplay; });
+        if(_stopReplay){
+            return;
+        }
+        _replayRequested = false;
+        _offlineLogPtr->rewind();
+        while(true){
+            _replayCondition.wait(lock, [this] {
+                return _replayInFlight < static_cast<int64_t>(_replayWindow) || _replayRequested || _stopReplay;
+            });
+            // a newer connection starts over from the oldest record
+            if(_replayRequested || _stopReplay || !_pahoMqttClientPtr->is_connected()){
+                break;
+            }
+            size_t room = _replayWindow - static_cast<size_t>(std::max<int64_t>(_replayInFlight, 0));
+            lock.unlock();
+            size_t replayed = _offlineLogPtr->read(std::min<size_t>(room, 1024), [this, &topic](const OfflineLog::record& logged){
+                {
+                    std::lock_guard<std::mutex> windowLock(_replayMutex);
+                    ++_replayInFlight;
+                }
+                topic.assign(logged.topic);
+                sendLogged(logged.sequence, true, topic, logged.payload, logged.qos, logged.retain);
+            });
+            lock.lock();
+            // caught up, publish sends directly again
+            if(replayed == 0){
+                break;
+            }
+        }
+    }
+}
+
+void MqttClient::offlineLog(OfflineLog::settings settings, size_t replayWindow){
+    _offlineLogPtr = std::make_unique<OfflineLog>(std::move(settings));
+    _replayWindow = std::max<size_t>(replayWindow, 1);
+    _callbacksPtr->setConnectionStateListener([this](bool connected){
+        if(!connected){
+            _offlineLogPtr->pause();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(_replayMutex);
+            _replayRequested = true;
+        }
+        _replayCondition.notify_all();
+    });
+    _replayThread = std::thread(&MqttClient::replayLoop, this);
+}
+
+void MqttClient::topicAliases(TopicAliases::settings settings){
+    if(_connectOptionsPtr->get_mqtt_version() < MQTTVERSION_5){
+        throw std::invalid_argument("Topic aliases need MQTT v5");
+    }
+    _callbacksPtr->topicAliases().configure(settings);
+    _aliasing = settings.outbound;
+    if(settings.maxInbound != 0){
+        mqtt::properties connectProps = _connectOptionsPtr->get_properties();
+        connectProps.add(mqtt::property(mqtt::property::code::TOPIC_ALIAS_MAXIMUM, settings.maxInbound));
+        _connectOptionsPtr->set_properties(connectProps);
+    }
+}
+
+void MqttClient::compression(PayloadCompression::settings settings){
+    if(_connectOptionsPtr->get_mqtt_version() < MQTTVERSION_5){
+        throw std::invalid_argument("Payload compression needs MQTT v5");
+    }
+    _callbacksPtr->compression().configure(std::move(settings));
+    _compressing = _callbacksPtr->compression().compresses();
+}
+
+void MqttClient::addCompressionDictionary(uint32_t id, std::string content){
+    _callbacksPtr->compression().addDictionary(id, std::move(content));
+}
+
+PayloadCompression::counters MqttClient::compressionCounters(){
+    return _callbacksPtr->compression().getCounters();
+}
+
+TopicAliases::counters MqttClient::topicAliasCounters(){
+    return _callbacksPtr->topicAliases().getCounters();
+}
+
+void MqttClient::cache(std::string topicFilter, int qos){
+    _callbacksPtr->cache(std::move(topicFilter), qos);
+}
+
+void MqttClient::cacheBudget(size_t budgetBytes){
+    _callbacksPtr->lastValues().setBudget(budgetBytes);
+}
+
+mqtt::const_message_ptr MqttClient::latest(std::string_view topic) const {
+    return _callbacksPtr->lastValues().latest(topic);
+}
+
+std::vector<mqtt::const_message_ptr> MqttClient::snapshot(const std::string& topicFilter) const {
+    return _callbacksPtr->lastValues().snapshot(topicFilter);
+}
+
+LastValueCache::counters MqttClient::cacheCounters() const {
+    return _callbacksPtr->lastValues().getCounters();
+}
+
+OfflineLog::counters MqttClient::offlineLogCounters(){
+    return _offlineLogPtr ? _offlineLogPtr->getCounters() : OfflineLog::counters();
+}
+
+int MqttClient::publish(const std::string& topic, const std::string& payload, int qos, bool retain, mqtt::iaction_listener& listener){
+    MqttMetrics& metrics = _callbacksPtr->metrics();
+    int64_t startedAt = metrics.enabled() ? MqttMetrics::now() : 0;
+    mqtt::delivery_token_ptr tok = send(topic, payload, qos, retain, nullptr, listener);
+    if(startedAt != 0){
+        metrics.publishSent(tok->get_message_id(), startedAt);
+    }
+    return tok->get_message_id();
+}
+
+void MqttClient::subscribe(const std::string& topicFilter, int qos, mqtt::iaction_listener& listener){
+    _pahoMqttClientPtr->subscribe(topicFilter, qos, nullptr, listener);
+}
+
+std::future<MqttCallbacks::PublishResult> MqttClient::publishBatch(const std::vector<publishEntry>& entries,
+    std::function<void(MqttCallbacks::PublishResult result, size_t failed)> onComplete){
+    MqttCallbacks* callbacks = _callbacksPtr.get();
+    return submitBatch(entries, [callbacks, onComplete](MqttCallbacks::PublishResult result, size_t failed){
+        if(onComplete){
+            onComplete(result, failed);
+        }
+        callbacks->publishBatchCompleted(result);
+    });
+}
+
+std::future<MqttCallbacks::PublishResult> MqttClient::submitBatch(const std::vector<publishEntry>& entries,
+    std::function<void(MqttCallbacks::PublishResult result, size_t failed)> onComplete){
+    std::shared_ptr<PublishBatch> batch = PublishBatch::create(entries.size(), onComplete);
+    std::future<MqttCallbacks::PublishResult> batchResult = batch->getFuture();
+    // payloads are compressed ahead of the alias lock, which only covers aliasing and submission
+    std::vector<std::string> compressed(_compressing ? entries.size() : 0);
+    std::vector<std::string_view> payloads(entries.size());
+    std::vector<mqtt::properties> props(entries.size());
+    for(size_t i = 0; i < entries.size(); ++i){
+        payloads[i] = _compressing ? encodePayload(entries[i].topic, entries[i].payload, compressed[i], props[i]) : std::string_view(entries[i].payload);
+    }
+    // aliases are assigned for the whole batch at once, so it holds the alias lock until submitted
+    std::unique_lock<std::mutex> aliasLock;
+    if(_aliasing){
+        aliasLock = _callbacksPtr->topicAliases().outboundLock();
+    }
+    // build all the messages up front so the submission loop only talks to paho
+    std::vector<mqtt::message_ptr> messages;
+    std::vector<bool> establishesAlias(entries.size(), false);
+    messages.reserve(entries.size());
+    for(size_t i = 0; i < entries.size(); ++i){
+        const publishEntry& entry = entries[i];
+        bool establishes = false;
+        messages.push_back(acquireMessage(entry.topic, payloads[i], entry.qos, entry.retain, std::move(props[i]), establishes));
+        establishesAlias[i] = establishes;
+    }
+    MqttMetrics& metrics = _callbacksPtr->metrics();
+    int64_t startedAt = metrics.enabled() ? MqttMetrics::now() : 0;
+    for(size_t i = 0; i < messages.size(); ++i){
+        try {
+            mqtt::delivery_token_ptr tok = _pahoMqttClientPtr->publish(std::move(messages[i]), nullptr, *batch);
+            if(startedAt != 0){
+                metrics.publishSent(tok->get_message_id(), startedAt);
+            }
+        } catch (const mqtt::exception& exc) {
+            if(establishesAlias[i]){
+                _callbacksPtr->topicAliases().forget(entries[i].topic);
+            }
+            batch->submitFailed();
+        }
+    }
+    return batchResult;
+}
+
+std::string_view MqttClient::encodePayload(const std::string& topic, std::string_view payload, std::string& out, mqtt::properties& props){
+    if(_compressing && _callbacksPtr->compression().compress(topic, payload, out, props)){
+        return out;
+    }
+    return payload;
+}
+
+mqtt::message_ptr MqttClient::acquireMessage(const std::string& topic, std::string_view payload, int qos, bool retain, mqtt::properties props, bool& establishesAlias){
+    establishesAlias = false;
+    bool known = false;
+    // paho buffers what is published while disconnected, QoS 0 included, for a later
+    // connection where no alias is set up. Checked under the alias lock, which
+    // connection_lost takes to drop the aliases
+    bool aliased = _aliasing && _pahoMqttClientPtr->is_connected();
+    uint16_t alias = aliased ? _callbacksPtr->topicAliases().assign(topic, qos, known) : 0;
+    if(alias == 0){
+        return props.empty() ? _callbacksPtr->messagePool().acquire(topic, payload, qos, retain)
+            : _callbacksPtr->messagePool().acquire(topic, payload, qos, retain, props);
+    }
+    establishesAlias = !known;
+    static const std::string aliasedTopic;
+    props.add(mqtt::property(mqtt::property::code::TOPIC_ALIAS, alias));
+    return _callbacksPtr->messagePool().acquire(known ? aliasedTopic : topic, payload, qos, retain, props);
+}
+
+mqtt::delivery_token_ptr MqttClient::send(const std::string& topic, std::string_view payload, int qos, bool retain, void* context, mqtt::iaction_listener& listener){
+    bool establishesAlias = false;
+    mqtt::properties props;
+    // reused by each publishing thread, the pool copies the payload out of it
+    thread_local std::string compressed;
+    payload = encodePayload(topic, payload, compressed, props);
+    if(!_aliasing){
+        return _pahoMqttClientPtr->publish(acquireMessage(topic, payload, qos, retain, std::move(props), establishesAlias), context, listener);
+    }
+    std::unique_lock<std::mutex> aliasLock = _callbacksPtr->topicAliases().outboundLock();
+    try {
+        return _pahoMqttClientPtr->publish(acquireMessage(topic, payload, qos, retain, std::move(props), establishesAlias), context, listener);
+    } catch (const mqtt::exception& exc) {
+        // the broker never saw the alias, the next publish of the topic must set it up again
+        if(establishesAlias){
+            _callbacksPtr->topicAliases().forget(topic);
+        }
+        throw;
+    }
+}
+
+std::future<mqtt::const_message_ptr> MqttClient::request(const std::string& topic, const std::string& payload, std::chrono::milliseconds timeout, int qos){
+    return _callbacksPtr->request(topic, payload, timeout, qos);
+}
+
+void MqttClient::dispatch(MqttCallbacks::dispatchSettings settings){
+    _callbacksPtr->dispatch(settings);
+}
+
+void MqttClient::addExecutor(const std::string& name, int numThreads, size_t queueCapacity){
+    _callbacksPtr->addExecutor(name, numThreads, queueCapacity);
+}
+
+void MqttClient::shaping(std::vector<PublishShaper::rule> rules){
+    _shaperPtr = std::make_unique<PublishShaper>(std::move(rules),
+        [this](const std::string& topic, const std::string& payload, int qos, bool retain){
+            return publishNow(topic, payload, qos, retain);
+        },
+        [this](MqttCallbacks::PublishResult result, const std::string& topic, const std::string& payload, int qos, bool retain){
+            _callbacksPtr->publishDiscarded(result, topic, payload, qos, retain);
+        });
+}
+
+PublishShaper::counters MqttClient::shapingCounters(){
+    return _shaperPtr ? _shaperPtr->getCounters() : PublishShaper::counters();
+}
+
+void MqttClient::reconnection(MqttCallbacks::reconnectSettings settings){
+    _callbacksPtr->reconnection(settings);
+}
+
 void MqttClient::lastWill(std::string topic, std::string payload, int qos, bool retain){
     mqtt::message_ptr msg = mqtt::make_message(topic, payload, qos, retain);
     mqtt::will_options will_opts(*msg);
     _connectOptionsPtr->set_will(will_opts);
 }
 
-void MqttClient::on(std::string topicFilter, std::function<std::string(std::string topic, std::string payload)> messageHandler){
-    _callbacksPtr->on(topicFilter, messageHandler);
+void MqttClient::on(std::string topicFilter, std::function<std::string(std::string topic, std::string payload)> messageHandler, int qos){
+    _callbacksPtr->on(topicFilter, messageHandler, qos);
+}
+
+void MqttClient::on(std::string topicFilter, MqttCallbacks::messageViewHandler messageHandler, int qos){
+    _callbacksPtr->on(topicFilter, std::move(messageHandler), qos);
+}
+
+void MqttClient::on(std::string topicFilter, std::function<std::string(std::string topic, std::string payload)> messageHandler, MqttCallbacks::subscriptionSettings settings){
+    _callbacksPtr->on(topicFilter, messageHandler, settings);
+}
+
+void MqttClient::on(std::string topicFilter, MqttCallbacks::messageViewHandler messageHandler, MqttCallbacks::subscriptionSettings settings){
+    _callbacksPtr->on(topicFilter, std::move(messageHandler), settings);
+}
+
+bool MqttClient::off(const std::string& topicFilter, const std::string& shareGroup){
+    return _callbacksPtr->off(topicFilter, shareGroup);
+}
+
+bool MqttClient::unsubscribe(const std::string& topicFilter, const std::string& shareGroup){
+    return _callbacksPtr->unsubscribe(topicFilter, shareGroup);
+}
+
+bool MqttClient::hasHandler(const std::string& topicFilter, const std::string& shareGroup){
+    return _callbacksPtr->hasHandler(topicFilter, shareGroup);
 }
 
 void MqttClient::onConnect(std::function<void()> onConnectCallback){
@@ -102,10 +548,22 @@ void MqttClient::onDisconnect(std::function<void()> onDisconnectCallback){
     _callbacksPtr->onDisconnect(onDisconnectCallback);
 }
 
+MqttMetrics& MqttClient::metrics(){
+    return _callbacksPtr->metrics();
+}
+
+MessagePool::counters MqttClient::messagePoolCounters(){
+    return _callbacksPtr->messagePool().getCounters();
+}
+
 void MqttClient::onPublishResult(std::function<void(MqttCallbacks::PublishResult result, int messageId, mqtt::const_message_ptr msg)> onPublishResultCallback){
     _callbacksPtr->onPublishResult(onPublishResultCallback);
 }
 
+void MqttClient::onHandlerError(std::function<void(const MqttCallbacks::handlerError& error)> onHandlerErrorCallback){
+    _callbacksPtr->onHandlerError(onHandlerErrorCallback);
+}
+
 bool MqttClient::isConnected(){
     return _pahoMqttClientPtr->is_connected();
 }
\ No newline at end of file
@@ -0,0 +1,185 @@
+#include "MqttClientPool.hpp"
+
+#include <stdexcept>
+
+MqttClientPool::MqttClientPool(std::string hostAddress, int port, std::string clientId, size_t connections, int mqttVersion){
+    if(connections == 0){
+        throw std::invalid_argument("MqttClientPool needs at least one connection");
+    }
+    for(size_t i = 0; i < connections; ++i){
+        _clients.push_back(std::make_unique<MqttClient>(hostAddress, port, clientId + "-" + std::to_string(i), mqttVersion, ""));
+    }
+    watchConnections();
+}
+
+MqttClientPool::MqttClientPool(std::string hostAddress, int port, std::string clientId, size_t connections, int mqttVersion, MqttClient::sslSettings sslParams){
+    if(connections == 0){
+        throw std::invalid_argument("MqttClientPool needs at least one connection");
+    }
+    for(size_t i = 0; i < connections; ++i){
+        _clients.push_back(std::make_unique<MqttClient>(hostAddress, port, clientId + "-" + std::to_string(i), mqttVersion, "", sslParams));
+    }
+    watchConnections();
+}
+
+void MqttClientPool::watchConnections(){
+    for(auto& client : _clients){
+        client->onConnect([this] {
+            if(_connectedClients.fetch_add(1, std::memory_order_acq_rel) + 1 == _clients.size() && _onConnectCallback){
+                _onConnectCallback();
+            }
+        });
+        client->onDisconnect([this] {
+            _connectedClients.fetch_sub(1, std::memory_order_acq_rel);
+            if(_onDisconnectCallback){
+                _onDisconnectCallback();
+            }
+        });
+    }
+}
+
+size_t MqttClientPool::shardOf(const std::string& topic) const {
+    return std::hash<std::string>()(topic) % _clients.size();
+}
+
+void MqttClientPool::start(){
+    _connectedClients = 0;
+    for(auto& client : _clients){
+        client->start();
+    }
+}
+
+void MqttClientPool::finish(){
+    for(auto& client : _clients){
+        client->finish();
+    }
+}
+
+int MqttClientPool::publish(const std::string& topic, const std::string& payload, int qos, bool retain){
+    return _clients[shardOf(topic)]->publish(topic, payload, qos, retain);
+}
+
+std::future<MqttCallbacks::PublishResult> MqttClientPool::publishBatch(const std::vector<MqttClient::publishEntry>& entries,
+    std::function<void(MqttCallbacks::PublishResult result, size_t failed)> onComplete){
+    std::vector<std::vector<MqttClient::publishEntry>> shards(_clients.size());
+    for(const MqttClient::publishEntry& entry : entries){
+        shards[shardOf(entry.topic)].push_back(entry);
+    }
+
+    // completion of the whole batch, once the last shard reported
+    struct poolBatch {
+        std::atomic<size_t> pending;
+        std::atomic<size_t> failed{0};
+        std::promise<MqttCallbacks::PublishResult> promise;
+        std::function<void(MqttCallbacks::PublishResult result, size_t failed)> onComplete;
+    };
+    auto batch = std::make_shared<poolBatch>();
+    batch->pending = _clients.size();
+    batch->onComplete = onComplete;
+    std::future<MqttCallbacks::PublishResult> batchResult = batch->promise.get_future();
+    // reported to onPublishResult once for the pool, not once per connection
+    MqttCallbacks* callbacks = _clients[0]->_callbacksPtr.get();
+    for(size_t i = 0; i < _clients.size(); ++i){
+        _clients[i]->submitBatch(shards[i], [batch, callbacks](MqttCallbacks::PublishResult result, size_t failed){
+            batch->failed.fetch_add(failed, std::memory_order_relaxed);
+            if(batch->pending.fetch_sub(1, std::memory_order_acq_rel) != 1){
+                return;
+            }
+            size_t totalFailed = batch->failed.load(std::memory_order_relaxed);
+            MqttCallbacks::PublishResult total = totalFailed == 0 ? MqttCallbacks::PUBLISH_SUCCESS : MqttCallbacks::PUBLISH_FAILURE;
+            batch->promise.set_value(total);
+            if(batch->onComplete){
+                batch->onComplete(total, totalFailed);
+            }
+            callbacks->publishBatchCompleted(total);
+        });
+    }
+    return batchResult;
+}
+
+void MqttClientPool::on(std::string topicFilter, std::function<std::string(std::string topic, std::string payload)> messageHandler, int qos){
+    _clients[shardOf(topicFilter)]->on(topicFilter, messageHandler, qos);
+}
+
+void MqttClientPool::on(std::string topicFilter, MqttCallbacks::messageViewHandler messageHandler, int qos){
+    _clients[shardOf(topicFilter)]->on(topicFilter, std::move(messageHandler), qos);
+}
+
+void MqttClientPool::on(std::string topicFilter, std::function<std::string(std::string topic, std::string payload)> messageHandler, MqttCallbacks::subscriptionSettings settings){
+    _clients[shardOf(topicFilter)]->on(topicFilter, messageHandler, settings);
+}
+
+void MqttClientPool::on(std::string topicFilter, MqttCallbacks::messageViewHandler messageHandler, MqttCallbacks::subscriptionSettings settings){
+    _clients[shardOf(topicFilter)]->on(topicFilter, std::move(messageHandler), settings);
+}
+
+bool MqttClientPool::off(const std::string& topicFilter, const std::string& shareGroup){
+    return _clients[shardOf(topicFilter)]->off(topicFilter, shareGroup);
+}
+
+bool MqttClientPool::unsubscribe(const std::string& topicFilter, const std::string& shareGroup){
+    return _clients[shardOf(topicFilter)]->unsubscribe(topicFilter, shareGroup);
+}
+
+void MqttClientPool::onConnect(std::function<void()> onConnectCallback){
+    _onConnectCallback = onConnectCallback;
+}
+
+void MqttClientPool::onDisconnect(std::function<void()> onDisconnectCallback){
+    _onDisconnectCallback = onDisconnectCallback;
+}
+
+void MqttClientPool::onPublishResult(std::function<void(MqttCallbacks::PublishResult result, int messageId, mqtt::const_message_ptr msg)> onPublishResultCallback){
+    for(auto& client : _clients){
+        client->onPublishResult(onPublishResultCallback);
+    }
+}
+
+void MqttClientPool::onHandlerError(std::function<void(const MqttCallbacks::handlerError& error)> onHandlerErrorCallback){
+    for(auto& client : _clients){
+        client->onHandlerError(onHandlerErrorCallback);
+    }
+}
+
+std::future<mqtt::const_message_ptr> MqttClientPool::request(const std::string& topic, const std::string& payload, std::chrono::milliseconds timeout, int qos){
+    return _clients[shardOf(topic)]->request(topic, payload, timeout, qos);
+}
+
+void MqttClientPool::dispatch(MqttCallbacks::dispatchSettings settings){
+    for(auto& client : _clients){
+        client->dispatch(settings);
+    }
+}
+
+void MqttClientPool::addExecutor(const std::string& name, int numThreads, size_t queueCapacity){
+    for(auto& client : _clients){
+        client->addExecutor(name, numThreads, queueCapacity);
+    }
+}
+
+void MqttClientPool::reconnection(MqttCallbacks::reconnectSettings settings){
+    for(auto& client : _clients){
+        client->reconnection(settings);
+    }
+}
+
+void MqttClientPool::lastWill(std::string topic, std::string payload, int qos, bool retain){
+    _clients[0]->lastWill(std::move(topic), std::move(payload), qos, retain);
+}
+
+bool MqttClientPool::isConnected(){
+    for(auto& client : _clients){
+        if(!client->isConnected()){
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t MqttClientPool::size() const {
+    return _clients.size();
+}
+
+MqttClient& MqttClientPool::client(size_t index){
+    return *_clients[index];
+}
@@ -0,0 +1,298 @@
+#include "MqttMetrics.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <sstream>
+
+MqttMetrics::filterStats::filterStats(std::string filter)
+    : _filter(std::move(filter)) {
+}
+
+MqttMetrics::filterStats::~filterStats(){
+    delete _handlerTime.load(std::memory_order_acquire);
+}
+
+void MqttMetrics::filterStats::record(uint64_t nanoseconds){
+    LatencyHistogram* histogram = _handlerTime.load(std::memory_order_acquire);
+    if(!histogram){
+        LatencyHistogram* created = new LatencyHistogram();
+        if(_handlerTime.compare_exchange_strong(histogram, created, std::memory_order_acq_rel)){
+            histogram = created;
+        } else {
+            // another worker won the race, histogram now holds its allocation
+            delete created;
+        }
+    }
+    histogram->record(nanoseconds);
+}
+
+const std::string& MqttMetrics::filterStats::filter() const {
+    return _filter;
+}
+
+const LatencyHistogram* MqttMetrics::filterStats::handlerTime() const {
+    return _handlerTime.load(std::memory_order_acquire);
+}
+
+MqttMetrics::MqttMetrics(std::string clientId)
+    : _clientId(std::move(clientId)) {
+}
+
+MqttMetrics::~MqttMetrics(){
+    {
+        std::lock_guard<std::mutex> lock(_dumpMutex);
+        _stopDump = true;
+    }
+    _dumpCondition.notify_all();
+    if(_dumpThread.joinable()){
+        _dumpThread.join();
+    }
+}
+
+int64_t MqttMetrics::now(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// an acknowledgement waiting longer than this for its publish belongs to an untracked one
+static constexpr int64_t earlyAckWindow = 1000000000;
+
+void MqttMetrics::enable(bool enabled){
+    if(_enabled.exchange(enabled, std::memory_order_relaxed) == enabled){
+        return;
+    }
+    // acknowledgements skipped while off would leave their publishes waiting forever
+    std::lock_guard<std::mutex> lock(_publishesMutex);
+    _publishStarts.clear();
+    _earlyAcks.clear();
+}
+
+void MqttMetrics::setWorkers(size_t numWorkers){
+    std::lock_guard<std::mutex> lock(_workersMutex);
+    _workers.clear();
+    for(size_t i = 0; i < numWorkers; ++i){
+        _workers.push_back(std::make_unique<workerStats>());
+    }
+}
+
+void MqttMetrics::setGauges(std::function<void(snapshot& current)> gauges){
+    std::lock_guard<std::mutex> lock(_gaugesMutex);
+    _gauges = std::move(gauges);
+}
+
+std::shared_ptr<MqttMetrics::filterStats> MqttMetrics::registerFilter(const std::string& filter){
+    std::lock_guard<std::mutex> lock(_filtersMutex);
+    std::weak_ptr<filterStats>& registered = _filters[filter];
+    std::shared_ptr<filterStats> stats = registered.lock();
+    if(!stats){
+        stats = std::make_shared<filterStats>(filter);
+        registered = stats;
+    }
+    if(_filters.size() >= _filtersPruneAt){
+        for(auto it = _filters.begin(); it != _filters.end(); ){
+            it = it->second.expired() ? _filters.erase(it) : std::next(it);
+        }
+        _filtersPruneAt = std::max<size_t>(64, _filters.size() * 2);
+    }
+    return stats;
+}
+
+void MqttMetrics::messageReceived(){
+    if(enabled()){
+        _received.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void MqttMetrics::messageHandled(size_t workerIndex, int64_t enqueuedAt, int64_t startedAt, int64_t finishedAt){
+    workerStats& worker = *_workers[workerIndex];
+    worker.handled.fetch_add(1, std::memory_order_relaxed);
+    worker.handlerTime.record(static_cast<uint64_t>(finishedAt - startedAt));
+    // messages queued while metrics were off carry no timestamp
+    if(enqueuedAt != 0){
+        worker.queueWait.record(static_cast<uint64_t>(startedAt - enqueuedAt));
+    }
+}
+
+void MqttMetrics::handlerError(size_t workerIndex){
+    _workers[workerIndex]->handlerErrors.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MqttMetrics::publishSent(int messageId, int64_t startedAt){
+    _published.fetch_add(1, std::memory_order_relaxed);
+    // QoS 0 messages have no id and no acknowledgement
+    if(messageId == 0){
+        return;
+    }
+    std::lock_guard<std::mutex> lock(_publishesMutex);
+    auto early = _earlyAcks.find(messageId);
+    if(early != _earlyAcks.end()){
+        int64_t acknowledgedAt = early->second;
+        _earlyAcks.erase(early);
+        // an older one acknowledged an earlier, untracked user of the same id
+        if(acknowledgedAt >= startedAt){
+            _publishRoundTrip.record(static_cast<uint64_t>(acknowledgedAt - startedAt));
+            return;
+        }
+    }
+    _publishStarts[messageId] = startedAt;
+}
+
+void MqttMetrics::publishAcknowledged(int messageId, bool success){
+    if(!success){
+        _publishFailures.fetch_add(1, std::memory_order_relaxed);
+    }
+    if(messageId == 0){
+        return;
+    }
+    int64_t acknowledgedAt = now();
+    std::lock_guard<std::mutex> lock(_publishesMutex);
+    auto started = _publishStarts.find(messageId);
+    if(started != _publishStarts.end()){
+        if(success){
+            _publishRoundTrip.record(static_cast<uint64_t>(acknowledgedAt - started->second));
+        }
+        _publishStarts.erase(started);
+    } else if(success){
+        if(_earlyAcks.size() >= _earlyAcksSweepAt){
+            for(auto it = _earlyAcks.begin(); it != _earlyAcks.end(); ){
+                it = acknowledgedAt - it->second > earlyAckWindow ? _earlyAcks.erase(it) : std::next(it);
+            }
+            _earlyAcksSweepAt = std::max<size_t>(1024, _earlyAcks.size() * 2);
+        }
+        _earlyAcks[messageId] = acknowledgedAt;
+    }
+}
+
+void MqttMetrics::actionFailed(){
+    if(enabled()){
+        _actionFailures.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+MqttMetrics::snapshot MqttMetrics::getSnapshot(){
+    snapshot current;
+    current.received = _received.load(std::memory_order_relaxed);
+    current.published = _published.load(std::memory_order_relaxed);
+    current.publishFailures = _publishFailures.load(std::memory_order_relaxed);
+    current.actionFailures = _actionFailures.load(std::memory_order_relaxed);
+
+    std::array<uint64_t, LatencyHistogram::bucketCount> queueWaitCounts{};
+    LatencyHistogram::summary queueWaitTotals;
+    std::unique_lock<std::mutex> workersLock(_workersMutex);
+    for(const auto& worker : _workers){
+        workerSnapshot workerCurrent;
+        workerCurrent.handled = worker->handled.load(std::memory_order_relaxed);
+        workerCurrent.handlerErrors = worker->handlerErrors.load(std::memory_order_relaxed);
+        workerCurrent.handlerTime = worker->handlerTime.summarize();
+        worker->queueWait.addTo(queueWaitCounts, queueWaitTotals);
+        current.handled += workerCurrent.handled;
+        current.handlerErrors += workerCurrent.handlerErrors;
+        current.workers.push_back(workerCurrent);
+    }
+    workersLock.unlock();
+    current.queueWait = LatencyHistogram::summarize(queueWaitCounts, queueWaitTotals);
+    current.publishRoundTrip = _publishRoundTrip.summarize();
+
+    {
+        std::lock_guard<std::mutex> lock(_filtersMutex);
+        for(auto it = _filters.begin(); it != _filters.end(); ){
+            std::shared_ptr<filterStats> stats = it->second.lock();
+            // every handler of the filter is gone
+            if(!stats){
+                it = _filters.erase(it);
+                continue;
+            }
+            const LatencyHistogram* handlerTime = stats->handlerTime();
+            if(handlerTime){
+                current.filters.emplace_back(stats->filter(), handlerTime->summarize());
+            }
+            ++it;
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(_gaugesMutex);
+        if(_gauges){
+            _gauges(current);
+        }
+    }
+    return current;
+}
+
+static std::string escapeLabel(const std::string& value){
+    std::string escaped;
+    escaped.reserve(value.size());
+    for(char c : value){
+        if(c == '\\' || c == '"'){
+            escaped += '\\';
+            escaped += c;
+        } else if(c == '\n'){
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+static void writeSummary(std::ostringstream& out, const std::string& name, const std::string& labels, const LatencyHistogram::summary& summary){
+    std::string separator = labels.empty() ? "" : ",";
+    const std::pair<const char*, uint64_t> quantiles[] = {
+        {"0.5", summary.p50}, {"0.9", summary.p90}, {"0.99", summary.p99}, {"0.999", summary.p999}
+    };
+    for(const auto& quantile : quantiles){
+        out << name << "{" << labels << separator << "quantile=\"" << quantile.first << "\"} " << quantile.second / 1e9 << "\n";
+    }
+    std::string braces = labels.empty() ? "" : "{" + labels + "}";
+    out << name << "_sum" << braces << " " << summary.sum / 1e9 << "\n";
+    out << name << "_count" << braces << " " << summary.count << "\n";
+}
+
+std::string MqttMetrics::prometheus(){
+    snapshot current = getSnapshot();
+    std::string client = "client=\"" + escapeLabel(_clientId) + "\"";
+    std::ostringstream out;
+    const std::pair<const char*, uint64_t> counters[] = {
+        {"mqtt_client_messages_received_total", current.received},
+        {"mqtt_client_messages_dropped_total", current.dropped},
+        {"mqtt_client_messages_handled_total", current.handled},
+        {"mqtt_client_handler_errors_total", current.handlerErrors},
+        {"mqtt_client_messages_published_total", current.published},
+        {"mqtt_client_publish_failures_total", current.publishFailures},
+        {"mqtt_client_action_failures_total", current.actionFailures}
+    };
+    for(const auto& counter : counters){
+        out << "# TYPE " << counter.first << " counter\n";
+        out << counter.first << "{" << client << "} " << counter.second << "\n";
+    }
+    out << "# TYPE mqtt_client_queue_depth gauge\n";
+    out << "mqtt_client_queue_depth{" << client << "} " << current.queueDepth << "\n";
+    out << "# TYPE mqtt_client_pending_requests gauge\n";
+    out << "mqtt_client_pending_requests{" << client << "} " << current.pendingRequests << "\n";
+
+    out << "# TYPE mqtt_client_queue_wait_seconds summary\n";
+    writeSummary(out, "mqtt_client_queue_wait_seconds", client, current.queueWait);
+    out << "# TYPE mqtt_client_publish_round_trip_seconds summary\n";
+    writeSummary(out, "mqtt_client_publish_round_trip_seconds", client, current.publishRoundTrip);
+    out << "# TYPE mqtt_client_worker_handler_seconds summary\n";
+    for(size_t i = 0; i < current.workers.size(); ++i){
+        writeSummary(out, "mqtt_client_worker_handler_seconds", client + ",worker=\"" + std::to_string(i) + "\"", current.workers[i].handlerTime);
+    }
+    out << "# TYPE mqtt_client_filter_handler_seconds summary\n";
+    for(const auto& filter : current.filters){
+        writeSummary(out, "mqtt_client_filter_handler_seconds", client + ",filter=\"" + escapeLabel(filter.first) + "\"", filter.second);
+    }
+    return out.str();
+}
+
+void MqttMetrics::dumpEvery(std::chrono::milliseconds interval, std::function<void(const std::string& text)> sink){
+    if(_dumpThread.joinable()){
+        return;
+    }
+    _dumpThread = std::thread([this, interval, sink] {
+        std::unique_lock<std::mutex> lock(_dumpMutex);
+        while(!_dumpCondition.wait_for(lock, interval, [this] { return _stopDump; })){
+            lock.unlock();
+            sink(prometheus());
+            lock.lock();
+        }
+    });
+}
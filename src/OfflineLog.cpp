@@ -0,0 +1,450 @@
+#include "OfflineLog.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static constexpr uint32_t segmentMagic = 0x4c4f514d; // "MQOL"
+static constexpr uint32_t segmentVersion = 1;
+
+static uint32_t crc32(const char* data, size_t size){
+    static const std::array<uint32_t, 256> table = [] {
+        std::array<uint32_t, 256> built{};
+        for(uint32_t i = 0; i < 256; ++i){
+            uint32_t value = i;
+            for(int bit = 0; bit < 8; ++bit){
+                value = (value & 1) ? (value >> 1) ^ 0xEDB88320u : value >> 1;
+            }
+            built[i] = value;
+        }
+        return built;
+    }();
+    uint32_t crc = 0xFFFFFFFFu;
+    for(size_t i = 0; i < size; ++i){
+        crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+    }
+    return crc ^ 0xFFFFFFFFu;
+}
+
+template <typename T>
+static T load(const char* at){
+    T value;
+    std::memcpy(&value, at, sizeof(T));
+    return value;
+}
+
+template <typename T>
+static void store(char* at, T value){
+    std::memcpy(at, &value, sizeof(T));
+}
+
+static std::runtime_error systemError(const std::string& what, const std::string& path){
+    return std::runtime_error(what + " " + path + ": " + std::strerror(errno));
+}
+
+OfflineLog::segment::~segment(){
+    if(data){
+        munmap(data, size);
+    }
+    if(fd >= 0){
+        close(fd);
+    }
+    if(remove){
+        unlink(path.c_str());
+    }
+}
+
+OfflineLog::OfflineLog(settings logSettings)
+    : _settings(std::move(logSettings)) {
+    if(_settings.directory.empty()){
+        throw std::invalid_argument("Offline log needs a directory");
+    }
+    if(_settings.segmentBytes < 4096){
+        throw std::invalid_argument("Offline log segments must be at least 4096 bytes");
+    }
+    if(_settings.maxBytes < 2 * static_cast<uint64_t>(_settings.segmentBytes)){
+        throw std::invalid_argument("Offline log maxBytes must hold at least two segments");
+    }
+    std::error_code error;
+    std::filesystem::create_directories(_settings.directory, error);
+    if(error){
+        throw std::runtime_error("Cannot create offline log directory " + _settings.directory + ": " + error.message());
+    }
+
+    std::string headPath = _settings.directory + "/head";
+    _headFd = open(headPath.c_str(), O_RDWR | O_CREAT, 0644);
+    if(_headFd < 0){
+        throw systemError("Cannot open", headPath);
+    }
+    // records below the acknowledged watermark of the previous run are not replayed
+    uint64_t headSequence = 0;
+    if(pread(_headFd, &headSequence, sizeof(headSequence), 0) != sizeof(headSequence)){
+        headSequence = 0;
+    }
+    _syncedHead = headSequence;
+
+    std::vector<std::pair<uint64_t, std::string>> found;
+    for(const auto& entry : std::filesystem::directory_iterator(_settings.directory)){
+        if(entry.path().extension() != ".seg"){
+            continue;
+        }
+        try {
+            found.emplace_back(std::stoull(entry.path().stem().string()), entry.path().string());
+        } catch (const std::exception& exc) {
+            // not one of ours
+        }
+    }
+    std::sort(found.begin(), found.end());
+    for(const auto& file : found){
+        std::shared_ptr<segment> seg = openSegment(file.second, file.first);
+        recover(*seg, headSequence);
+        _counters.bytesOnDisk += seg->size;
+        _counters.pending += seg->pending;
+        if(seg->acked.size() > 0){
+            _nextSequence = std::max(_nextSequence, seg->firstSequence + seg->acked.size());
+        }
+        _nextSegmentId = file.first + 1;
+        _segments.push_back(std::move(seg));
+    }
+    _nextSequence = std::max(_nextSequence, headSequence);
+    trim();
+    // appends continue in the last segment only if its sequences carry on without a gap
+    if(_segments.empty() || _segments.back()->firstSequence + _segments.back()->acked.size() != _nextSequence){
+        _segments.push_back(createSegment(_nextSequence));
+    }
+    _cursorSegment = _segments.front()->id;
+    _cursorOffset = headerBytes;
+
+    if(_settings.syncInterval.count() > 0){
+        _syncThread = std::thread(&OfflineLog::syncLoop, this);
+    }
+}
+
+OfflineLog::~OfflineLog(){
+    {
+        std::lock_guard<std::mutex> lock(_syncMutex);
+        _stopSync = true;
+    }
+    _syncCondition.notify_all();
+    if(_syncThread.joinable()){
+        _syncThread.join();
+    }
+    sync();
+    _segments.clear();
+    close(_headFd);
+}
+
+std::shared_ptr<OfflineLog::segment> OfflineLog::openSegment(const std::string& path, uint64_t id){
+    auto seg = std::make_shared<segment>();
+    seg->id = id;
+    seg->path = path;
+    seg->fd = open(path.c_str(), O_RDWR);
+    if(seg->fd < 0){
+        throw systemError("Cannot open", path);
+    }
+    struct stat status;
+    if(fstat(seg->fd, &status) != 0){
+        throw systemError("Cannot stat", path);
+    }
+    seg->size = static_cast<size_t>(status.st_size);
+    if(seg->size < headerBytes){
+        throw std::runtime_error("Truncated offline log segment " + path);
+    }
+    void* mapped = mmap(nullptr, seg->size, PROT_READ | PROT_WRITE, MAP_SHARED, seg->fd, 0);
+    if(mapped == MAP_FAILED){
+        throw systemError("Cannot map", path);
+    }
+    seg->data = static_cast<char*>(mapped);
+    if(load<uint32_t>(seg->data) != segmentMagic || load<uint32_t>(seg->data + 4) != segmentVersion){
+        throw std::runtime_error("Not an offline log segment " + path);
+    }
+    seg->firstSequence = load<uint64_t>(seg->data + 8);
+    return seg;
+}
+
+std::shared_ptr<OfflineLog::segment> OfflineLog::createSegment(uint64_t firstSequence){
+    char name[32];
+    std::snprintf(name, sizeof(name), "%020llu.seg", static_cast<unsigned long long>(_nextSegmentId));
+    auto seg = std::make_shared<segment>();
+    seg->id = _nextSegmentId++;
+    seg->path = _settings.directory + "/" + name;
+    seg->fd = open(seg->path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(seg->fd < 0){
+        throw systemError("Cannot create", seg->path);
+    }
+    seg->size = _settings.segmentBytes;
+    // allocated up front so a full disk fails here rather than as SIGBUS on a mapped write
+    int allocated = posix_fallocate(seg->fd, 0, static_cast<off_t>(seg->size));
+    if(allocated == EINVAL || allocated == EOPNOTSUPP){
+        allocated = ftruncate(seg->fd, static_cast<off_t>(seg->size)) == 0 ? 0 : errno;
+    }
+    if(allocated != 0){
+        seg->remove = true;
+        errno = allocated;
+        throw systemError("Cannot allocate", seg->path);
+    }
+    void* mapped = mmap(nullptr, seg->size, PROT_READ | PROT_WRITE, MAP_SHARED, seg->fd, 0);
+    if(mapped == MAP_FAILED){
+        seg->remove = true;
+        throw systemError("Cannot map", seg->path);
+    }
+    seg->data = static_cast<char*>(mapped);
+    store<uint32_t>(seg->data, segmentMagic);
+    store<uint32_t>(seg->data + 4, segmentVersion);
+    store<uint64_t>(seg->data + 8, firstSequence);
+    seg->firstSequence = firstSequence;
+    seg->writeOffset = headerBytes;
+    _counters.bytesOnDisk += seg->size;
+    return seg;
+}
+
+void OfflineLog::recover(segment& seg, uint64_t headSequence){
+    size_t offset = headerBytes;
+    while(offset + recordHeaderBytes + bodyHeaderBytes <= seg.size){
+        uint32_t length = load<uint32_t>(seg.data + offset);
+        const char* body = seg.data + offset + recordHeaderBytes;
+        if(length < bodyHeaderBytes || length > seg.size - offset - recordHeaderBytes
+            || load<uint32_t>(seg.data + offset + 4) != crc32(body, length)
+            || load<uint64_t>(body) != seg.firstSequence + seg.acked.size()){
+            break;
+        }
+        bool acked = load<uint64_t>(body) < headSequence;
+        seg.acked.push_back(acked);
+        if(!acked){
+            ++seg.pending;
+        }
+        offset += recordHeaderBytes + length;
+    }
+    seg.writeOffset = offset;
+    // what was there before the crash is on disk already
+    seg.syncedOffset = offset;
+    while(seg.firstPending < seg.acked.size() && seg.acked[seg.firstPending]){
+        ++seg.firstPending;
+    }
+}
+
+bool OfflineLog::reserve(size_t bytes){
+    segment& active = *_segments.back();
+    if(bytes <= active.size - active.writeOffset){
+        return true;
+    }
+    while(_counters.bytesOnDisk + _settings.segmentBytes > _settings.maxBytes){
+        if(_settings.full == FULL_REJECT || _segments.size() < 2){
+            return false;
+        }
+        segment& oldest = *_segments.front();
+        _counters.dropped += oldest.pending;
+        _counters.pending -= oldest.pending;
+        _counters.bytesOnDisk -= oldest.size;
+        oldest.remove = true;
+        _segments.pop_front();
+    }
+    _segments.push_back(createSegment(_nextSequence));
+    return true;
+}
+
+void OfflineLog::trim(){
+    while(_segments.size() > 1 && _segments.front()->pending == 0){
+        _counters.bytesOnDisk -= _segments.front()->size;
+        _segments.front()->remove = true;
+        _segments.pop_front();
+    }
+}
+
+uint64_t OfflineLog::headSequence(){
+    for(const auto& seg : _segments){
+        if(seg->pending > 0){
+            return seg->firstSequence + seg->firstPending;
+        }
+    }
+    return _nextSequence;
+}
+
+OfflineLog::appendResult OfflineLog::append(std::string_view topic, std::string_view payload, int qos, bool retain){
+    if(topic.size() > UINT16_MAX){
+        throw std::invalid_argument("Topic too long for the offline log");
+    }
+    size_t length = bodyHeaderBytes + topic.size() + payload.size();
+    size_t bytes = recordHeaderBytes + length;
+    if(bytes > _settings.segmentBytes - headerBytes){
+        throw std::invalid_argument("Message larger than an offline log segment");
+    }
+
+    appendResult result;
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(!reserve(bytes)){
+        ++_counters.rejected;
+        return result;
+    }
+    segment& active = *_segments.back();
+    char* at = active.data + active.writeOffset;
+    char* body = at + recordHeaderBytes;
+    result.sequence = _nextSequence++;
+    store<uint64_t>(body, result.sequence);
+    store<uint8_t>(body + 8, static_cast<uint8_t>(qos));
+    store<uint8_t>(body + 9, retain ? 1 : 0);
+    store<uint16_t>(body + 10, static_cast<uint16_t>(topic.size()));
+    std::memcpy(body + bodyHeaderBytes, topic.data(), topic.size());
+    std::memcpy(body + bodyHeaderBytes + topic.size(), payload.data(), payload.size());
+    store<uint32_t>(at + 4, crc32(body, length));
+    store<uint32_t>(at, static_cast<uint32_t>(length));
+    active.writeOffset += bytes;
+    active.acked.push_back(false);
+    ++active.pending;
+    ++_counters.appended;
+    ++_counters.pending;
+
+    result.send = _caughtUp;
+    if(_caughtUp){
+        _cursorSegment = active.id;
+        _cursorOffset = active.writeOffset;
+    }
+    return result;
+}
+
+void OfflineLog::acknowledge(uint64_t sequence){
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto after = std::upper_bound(_segments.begin(), _segments.end(), sequence,
+        [](uint64_t value, const std::shared_ptr<segment>& seg){ return value < seg->firstSequence; });
+    // older than the log: trimmed, dropped, or acknowledged before a restart
+    if(after == _segments.begin()){
+        return;
+    }
+    segment& seg = **std::prev(after);
+    size_t index = sequence - seg.firstSequence;
+    if(index >= seg.acked.size() || seg.acked[index]){
+        return;
+    }
+    seg.acked[index] = true;
+    --seg.pending;
+    --_counters.pending;
+    ++_counters.acknowledged;
+    while(seg.firstPending < seg.acked.size() && seg.acked[seg.firstPending]){
+        ++seg.firstPending;
+    }
+    trim();
+}
+
+size_t OfflineLog::read(size_t maxRecords, const std::function<void(const record&)>& consumer){
+    std::vector<std::pair<std::shared_ptr<segment>, size_t>> positions;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(_cursorSegment < _segments.front()->id){
+            _cursorSegment = _segments.front()->id;
+            _cursorOffset = headerBytes;
+        }
+        size_t current = 0;
+        while(_segments[current]->id != _cursorSegment){
+            ++current;
+        }
+        while(positions.size() < maxRecords){
+            const std::shared_ptr<segment>& seg = _segments[current];
+            if(_cursorOffset >= seg->writeOffset){
+                if(current + 1 == _segments.size()){
+                    break;
+                }
+                ++current;
+                _cursorSegment = _segments[current]->id;
+                _cursorOffset = headerBytes;
+                continue;
+            }
+            const char* at = seg->data + _cursorOffset;
+            size_t index = load<uint64_t>(at + recordHeaderBytes) - seg->firstSequence;
+            if(!seg->acked[index]){
+                positions.emplace_back(seg, _cursorOffset);
+            }
+            _cursorOffset += recordHeaderBytes + load<uint32_t>(at);
+        }
+        if(positions.empty()){
+            _caughtUp = true;
+            return 0;
+        }
+    }
+    // records below writeOffset never change, the shared_ptr keeps their mapping
+    for(const auto& position : positions){
+        const char* body = position.first->data + position.second + recordHeaderBytes;
+        uint32_t length = load<uint32_t>(body - recordHeaderBytes);
+        uint16_t topicLength = load<uint16_t>(body + 10);
+        record current;
+        current.sequence = load<uint64_t>(body);
+        current.qos = load<uint8_t>(body + 8);
+        current.retain = load<uint8_t>(body + 9) != 0;
+        current.topic = std::string_view(body + bodyHeaderBytes, topicLength);
+        current.payload = std::string_view(body + bodyHeaderBytes + topicLength, length - bodyHeaderBytes - topicLength);
+        consumer(current);
+    }
+    return positions.size();
+}
+
+void OfflineLog::pause(){
+    std::lock_guard<std::mutex> lock(_mutex);
+    _caughtUp = false;
+}
+
+void OfflineLog::rewind(){
+    std::lock_guard<std::mutex> lock(_mutex);
+    _caughtUp = false;
+    _cursorSegment = _segments.front()->id;
+    _cursorOffset = headerBytes;
+}
+
+void OfflineLog::sync(){
+    std::lock_guard<std::mutex> flushLock(_flushMutex);
+    struct range {
+        std::shared_ptr<segment> seg;
+        size_t begin;
+        size_t end;
+    };
+    std::vector<range> ranges;
+    uint64_t head;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for(const auto& seg : _segments){
+            if(seg->writeOffset > seg->syncedOffset){
+                ranges.push_back({seg, seg->syncedOffset, seg->writeOffset});
+            }
+        }
+        head = headSequence();
+    }
+    if(ranges.empty() && head == _syncedHead){
+        return;
+    }
+    // one flush for every record appended since the last one
+    static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    for(const range& dirty : ranges){
+        size_t begin = dirty.begin - dirty.begin % pageSize;
+        msync(dirty.seg->data + begin, dirty.end - begin, MS_SYNC);
+    }
+    if(head != _syncedHead && pwrite(_headFd, &head, sizeof(head), 0) == sizeof(head)){
+        fdatasync(_headFd);
+        _syncedHead = head;
+    }
+    std::lock_guard<std::mutex> lock(_mutex);
+    for(const range& dirty : ranges){
+        dirty.seg->syncedOffset = std::max(dirty.seg->syncedOffset, dirty.end);
+    }
+    ++_counters.syncs;
+}
+
+void OfflineLog::syncLoop(){
+    std::unique_lock<std::mutex> lock(_syncMutex);
+    while(!_syncCondition.wait_for(lock, _settings.syncInterval, [this] { return _stopSync; })){
+        lock.unlock();
+        sync();
+        lock.lock();
+    }
+}
+
+OfflineLog::counters OfflineLog::getCounters(){
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _counters;
+}
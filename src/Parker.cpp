@@ -0,0 +1,44 @@
+#include "Parker.hpp"
+
+uint64_t Parker::prepareWait(){
+    _waiters.fetch_add(1, std::memory_order_seq_cst);
+    // pairs with the fence in notify: either the notifier sees this waiter
+    // or the waiter's re-check sees the notifier's update
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    return _epoch.load(std::memory_order_seq_cst);
+}
+
+void Parker::cancelWait(){
+    _waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void Parker::commitWait(uint64_t epoch){
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _conditionVariable.wait(lock, [this, epoch] {
+            return _epoch.load(std::memory_order_seq_cst) != epoch;
+        });
+    }
+    _waiters.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool Parker::notifyOne(){
+    _epoch.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(_waiters.load(std::memory_order_seq_cst) > 0){
+        // taking the lock orders the epoch update with a waiter checking it
+        { std::lock_guard<std::mutex> lock(_mutex); }
+        _conditionVariable.notify_one();
+        return true;
+    }
+    return false;
+}
+
+void Parker::notifyAll(){
+    _epoch.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(_waiters.load(std::memory_order_seq_cst) > 0){
+        { std::lock_guard<std::mutex> lock(_mutex); }
+        _conditionVariable.notify_all();
+    }
+}
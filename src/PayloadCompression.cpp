@@ -0,0 +1,307 @@
+#include "PayloadCompression.hpp"
+
+#include <cstdlib>
+#include <stdexcept>
+
+#ifdef MQTT_CLIENT_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef MQTT_CLIENT_WITH_LZ4
+#include <lz4.h>
+#endif
+
+static const std::string encodingProperty = "content-encoding";
+
+// what inflated messages keep of the properties of the compressed one
+static const mqtt::property::code keptProperties[] = {
+    mqtt::property::code::PAYLOAD_FORMAT_INDICATOR,
+    mqtt::property::code::MESSAGE_EXPIRY_INTERVAL,
+    mqtt::property::code::CONTENT_TYPE,
+    mqtt::property::code::RESPONSE_TOPIC,
+    mqtt::property::code::CORRELATION_DATA,
+    mqtt::property::code::SUBSCRIPTION_IDENTIFIER,
+    mqtt::property::code::USER_PROPERTY
+};
+
+struct PayloadCompression::dictionary {
+    uint32_t id = 0;
+    std::string content;
+#ifdef MQTT_CLIENT_WITH_ZSTD
+    std::unique_ptr<ZSTD_DDict, size_t(*)(ZSTD_DDict*)> zstdInflate{nullptr, ZSTD_freeDDict};
+#endif
+};
+
+// contexts are kept by each thread, publishes come from any of them
+#ifdef MQTT_CLIENT_WITH_ZSTD
+static ZSTD_CCtx* zstdCompressContext(){
+    thread_local std::unique_ptr<ZSTD_CCtx, size_t(*)(ZSTD_CCtx*)> context(ZSTD_createCCtx(), ZSTD_freeCCtx);
+    return context.get();
+}
+
+static ZSTD_DCtx* zstdInflateContext(){
+    thread_local std::unique_ptr<ZSTD_DCtx, size_t(*)(ZSTD_DCtx*)> context(ZSTD_createDCtx(), ZSTD_freeDCtx);
+    return context.get();
+}
+#endif
+
+#ifdef MQTT_CLIENT_WITH_LZ4
+static LZ4_stream_t* lz4Stream(){
+    thread_local std::unique_ptr<LZ4_stream_t, int(*)(LZ4_stream_t*)> stream(LZ4_createStream(), LZ4_freeStream);
+    return stream.get();
+}
+#endif
+
+PayloadCompression::PayloadCompression() = default;
+
+PayloadCompression::~PayloadCompression() = default;
+
+bool PayloadCompression::available(Algorithm algorithm){
+    switch(algorithm){
+        case COMPRESSION_NONE:
+            return true;
+        case COMPRESSION_LZ4:
+#ifdef MQTT_CLIENT_WITH_LZ4
+            return true;
+#else
+            return false;
+#endif
+        case COMPRESSION_ZSTD:
+#ifdef MQTT_CLIENT_WITH_ZSTD
+            return true;
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+void PayloadCompression::addDictionary(uint32_t id, std::string content){
+    if(id == 0 || _dictionaries.count(id) != 0){
+        throw std::invalid_argument("Compression dictionary id 0 or taken: " + std::to_string(id));
+    }
+    auto added = std::make_unique<dictionary>();
+    added->id = id;
+    added->content = std::move(content);
+#ifdef MQTT_CLIENT_WITH_ZSTD
+    added->zstdInflate.reset(ZSTD_createDDict(added->content.data(), added->content.size()));
+#endif
+    _dictionaries.emplace(id, std::move(added));
+    _inflates = true;
+}
+
+void PayloadCompression::configure(settings newSettings){
+    std::vector<compiledRule> rules;
+    for(const rule& settingsRule : newSettings.rules){
+        compiledRule compiled;
+        compiled.settings = settingsRule;
+        if(!available(settingsRule.algorithm)){
+            throw std::invalid_argument("Compression algorithm not built in, rule " + settingsRule.topicPrefix);
+        }
+        if(settingsRule.dictionary != 0){
+            auto found = _dictionaries.find(settingsRule.dictionary);
+            if(found == _dictionaries.end()){
+                throw std::invalid_argument("Unknown compression dictionary: " + std::to_string(settingsRule.dictionary));
+            }
+            compiled.shared = found->second.get();
+        }
+        compiled.encoding = settingsRule.algorithm == COMPRESSION_ZSTD ? "zstd" : "lz4";
+        if(compiled.shared){
+            compiled.encoding += ":" + std::to_string(compiled.shared->id);
+        }
+#ifdef MQTT_CLIENT_WITH_ZSTD
+        if(settingsRule.algorithm == COMPRESSION_ZSTD && compiled.shared){
+            compiled.zstdDictionary = std::shared_ptr<void>(
+                ZSTD_createCDict(compiled.shared->content.data(), compiled.shared->content.size(), settingsRule.level), ZSTD_freeCDict);
+        }
+#endif
+        rules.push_back(std::move(compiled));
+    }
+    _settings = std::move(newSettings);
+    _rules = std::move(rules);
+}
+
+bool PayloadCompression::compresses() const {
+    return !_rules.empty();
+}
+
+bool PayloadCompression::inflates() const {
+    return _inflates;
+}
+
+const PayloadCompression::compiledRule* PayloadCompression::findRule(const std::string& topic) const {
+    const compiledRule* best = nullptr;
+    for(const compiledRule& candidate : _rules){
+        const std::string& prefix = candidate.settings.topicPrefix;
+        if(topic.compare(0, prefix.size(), prefix) == 0 && (!best || prefix.size() > best->settings.topicPrefix.size())){
+            best = &candidate;
+        }
+    }
+    return best;
+}
+
+bool PayloadCompression::compress(const std::string& topic, std::string_view payload, std::string& out, mqtt::properties& props){
+    const compiledRule* matched = findRule(topic);
+    if(!matched || matched->settings.algorithm == COMPRESSION_NONE){
+        return false;
+    }
+    if(payload.size() < matched->settings.minBytes){
+        _skippedSmall.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    size_t written = 0;
+    switch(matched->settings.algorithm){
+#ifdef MQTT_CLIENT_WITH_ZSTD
+        case COMPRESSION_ZSTD:{
+            out.resize(ZSTD_compressBound(payload.size()));
+            size_t result = matched->zstdDictionary
+                ? ZSTD_compress_usingCDict(zstdCompressContext(), out.data(), out.size(), payload.data(), payload.size(),
+                    static_cast<const ZSTD_CDict*>(matched->zstdDictionary.get()))
+                : ZSTD_compressCCtx(zstdCompressContext(), out.data(), out.size(), payload.data(), payload.size(), matched->settings.level);
+            if(ZSTD_isError(result)){
+                return false;
+            }
+            written = result;
+            break;
+        }
+#endif
+#ifdef MQTT_CLIENT_WITH_LZ4
+        case COMPRESSION_LZ4:{
+            if(payload.size() > LZ4_MAX_INPUT_SIZE){
+                return false;
+            }
+            int size = static_cast<int>(payload.size());
+            out.resize(4 + LZ4_compressBound(size));
+            for(int i = 0; i < 4; ++i){
+                out[i] = static_cast<char>((payload.size() >> (8 * i)) & 0xFF);
+            }
+            int acceleration = matched->settings.level > 0 ? matched->settings.level : 1;
+            int result;
+            if(matched->shared){
+                LZ4_stream_t* stream = lz4Stream();
+                LZ4_loadDict(stream, matched->shared->content.data(), static_cast<int>(matched->shared->content.size()));
+                result = LZ4_compress_fast_continue(stream, payload.data(), out.data() + 4, size, static_cast<int>(out.size() - 4), acceleration);
+            } else {
+                result = LZ4_compress_fast(payload.data(), out.data() + 4, size, static_cast<int>(out.size() - 4), acceleration);
+            }
+            if(result <= 0){
+                return false;
+            }
+            written = 4 + static_cast<size_t>(result);
+            break;
+        }
+#endif
+        default:
+            return false;
+    }
+    if(written >= payload.size()){
+        _incompressible.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    out.resize(written);
+    props.add(mqtt::property(mqtt::property::code::USER_PROPERTY, encodingProperty, matched->encoding));
+    _compressed.fetch_add(1, std::memory_order_relaxed);
+    _bytesIn.fetch_add(payload.size(), std::memory_order_relaxed);
+    _bytesOut.fetch_add(written, std::memory_order_relaxed);
+    return true;
+}
+
+bool PayloadCompression::inflate(std::string_view encoding, std::string_view payload, std::string& out) const {
+    size_t colon = encoding.find(':');
+    [[maybe_unused]] std::string_view algorithm = encoding.substr(0, colon);
+    [[maybe_unused]] const dictionary* shared = nullptr;
+    if(colon != std::string_view::npos){
+        uint32_t id = static_cast<uint32_t>(std::strtoul(std::string(encoding.substr(colon + 1)).c_str(), nullptr, 10));
+        auto found = _dictionaries.find(id);
+        if(found == _dictionaries.end()){
+            return false;
+        }
+        shared = found->second.get();
+    }
+#ifdef MQTT_CLIENT_WITH_ZSTD
+    if(algorithm == "zstd"){
+        unsigned long long size = ZSTD_getFrameContentSize(payload.data(), payload.size());
+        if(size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR || size > _settings.maxInflatedBytes){
+            return false;
+        }
+        out.resize(size);
+        size_t result = shared
+            ? ZSTD_decompress_usingDDict(zstdInflateContext(), out.data(), out.size(), payload.data(), payload.size(), shared->zstdInflate.get())
+            : ZSTD_decompressDCtx(zstdInflateContext(), out.data(), out.size(), payload.data(), payload.size());
+        return !ZSTD_isError(result) && result == size;
+    }
+#endif
+#ifdef MQTT_CLIENT_WITH_LZ4
+    if(algorithm == "lz4"){
+        if(payload.size() < 4 || payload.size() - 4 > LZ4_MAX_INPUT_SIZE){
+            return false;
+        }
+        size_t size = 0;
+        for(int i = 0; i < 4; ++i){
+            size |= static_cast<size_t>(static_cast<uint8_t>(payload[i])) << (8 * i);
+        }
+        if(size > _settings.maxInflatedBytes || size > LZ4_MAX_INPUT_SIZE){
+            return false;
+        }
+        out.resize(size);
+        int compressedSize = static_cast<int>(payload.size() - 4);
+        int result = shared
+            ? LZ4_decompress_safe_usingDict(payload.data() + 4, out.data(), compressedSize, static_cast<int>(size),
+                shared->content.data(), static_cast<int>(shared->content.size()))
+            : LZ4_decompress_safe(payload.data() + 4, out.data(), compressedSize, static_cast<int>(size));
+        return result == static_cast<int>(size);
+    }
+#endif
+    return false;
+}
+
+bool PayloadCompression::decompress(const mqtt::message& msg, std::string& out, mqtt::properties& props){
+    const mqtt::properties& msgProps = msg.get_properties();
+    size_t userProperties = msgProps.count(mqtt::property::code::USER_PROPERTY);
+    if(userProperties == 0){
+        return false;
+    }
+    size_t encodingIndex = userProperties;
+    std::string encoding;
+    for(size_t i = 0; i < userProperties && encodingIndex == userProperties; ++i){
+        mqtt::string_pair userProperty = mqtt::get<mqtt::string_pair>(msgProps.get(mqtt::property::code::USER_PROPERTY, i));
+        if(std::get<0>(userProperty) == encodingProperty){
+            encodingIndex = i;
+            encoding = std::get<1>(userProperty);
+        }
+    }
+    if(encodingIndex == userProperties){
+        return false;
+    }
+    std::string_view algorithm = std::string_view(encoding).substr(0, encoding.find(':'));
+    if(!(algorithm == "zstd" && available(COMPRESSION_ZSTD)) && !(algorithm == "lz4" && available(COMPRESSION_LZ4))){
+        _passedThrough.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    if(!inflate(encoding, msg.get_payload(), out)){
+        _inflateFailures.fetch_add(1, std::memory_order_relaxed);
+        throw std::runtime_error("Cannot inflate " + encoding + " payload of " + msg.get_topic());
+    }
+    for(mqtt::property::code code : keptProperties){
+        size_t count = msgProps.count(code);
+        for(size_t i = 0; i < count; ++i){
+            if(code != mqtt::property::code::USER_PROPERTY || i != encodingIndex){
+                props.add(msgProps.get(code, i));
+            }
+        }
+    }
+    _inflated.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+PayloadCompression::counters PayloadCompression::getCounters() const {
+    counters current;
+    current.compressed = _compressed.load(std::memory_order_relaxed);
+    current.skippedSmall = _skippedSmall.load(std::memory_order_relaxed);
+    current.incompressible = _incompressible.load(std::memory_order_relaxed);
+    current.bytesIn = _bytesIn.load(std::memory_order_relaxed);
+    current.bytesOut = _bytesOut.load(std::memory_order_relaxed);
+    current.inflated = _inflated.load(std::memory_order_relaxed);
+    current.inflateFailures = _inflateFailures.load(std::memory_order_relaxed);
+    current.passedThrough = _passedThrough.load(std::memory_order_relaxed);
+    return current;
+}
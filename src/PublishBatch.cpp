@@ -0,0 +1,51 @@
+#include "PublishBatch.hpp"
+
+PublishBatch::PublishBatch(size_t size, std::function<void(MqttCallbacks::PublishResult result, size_t failed)> onComplete)
+    : _pending(size), _onComplete(onComplete) {
+}
+
+std::shared_ptr<PublishBatch> PublishBatch::create(size_t size, std::function<void(MqttCallbacks::PublishResult result, size_t failed)> onComplete){
+    auto batch = std::make_shared<PublishBatch>(size, onComplete);
+    if(size == 0){
+        batch->_promise.set_value(MqttCallbacks::PUBLISH_SUCCESS);
+        if(onComplete){
+            onComplete(MqttCallbacks::PUBLISH_SUCCESS, 0);
+        }
+    } else {
+        batch->_self = batch;
+    }
+    return batch;
+}
+
+std::future<MqttCallbacks::PublishResult> PublishBatch::getFuture(){
+    return _promise.get_future();
+}
+
+void PublishBatch::complete(bool success){
+    if(!success){
+        _failed.fetch_add(1, std::memory_order_relaxed);
+    }
+    if(_pending.fetch_sub(1, std::memory_order_acq_rel) != 1){
+        return;
+    }
+    size_t failed = _failed.load(std::memory_order_relaxed);
+    MqttCallbacks::PublishResult result = failed == 0 ? MqttCallbacks::PUBLISH_SUCCESS : MqttCallbacks::PUBLISH_FAILURE;
+    _promise.set_value(result);
+    if(_onComplete){
+        _onComplete(result, failed);
+    }
+    // last reference may be this one
+    std::shared_ptr<PublishBatch> self = std::move(_self);
+}
+
+void PublishBatch::submitFailed(){
+    complete(false);
+}
+
+void PublishBatch::on_failure(const mqtt::token& tok){
+    complete(false);
+}
+
+void PublishBatch::on_success(const mqtt::token& tok){
+    complete(true);
+}
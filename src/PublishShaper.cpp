@@ -0,0 +1,276 @@
+#include "PublishShaper.hpp"
+
+#include <algorithm>
+
+PublishShaper::PublishShaper(std::vector<rule> rules, sender send, reporter report)
+    : _send(send), _report(report) {
+    auto now = std::chrono::steady_clock::now();
+    for(rule& settings : rules){
+        ruleState state;
+        state.settings = std::move(settings);
+        state.tokens = state.settings.burst;
+        state.refilledAt = now;
+        _rules.push_back(std::move(state));
+    }
+}
+
+PublishShaper::~PublishShaper(){
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _timerCondition.notify_all();
+    if(_timerThread.joinable()){
+        _timerThread.join();
+    }
+}
+
+int PublishShaper::ruleOf(std::string_view topic) const {
+    int best = -1;
+    size_t bestLength = 0;
+    for(size_t i = 0; i < _rules.size(); ++i){
+        const std::string& prefix = _rules[i].settings.topicPrefix;
+        if(topic.substr(0, prefix.size()) == prefix && (best < 0 || prefix.size() > bestLength)){
+            best = static_cast<int>(i);
+            bestLength = prefix.size();
+        }
+    }
+    return best;
+}
+
+void PublishShaper::addTimer(std::chrono::steady_clock::time_point at, size_t ruleIndex, std::string topic, uint64_t generation){
+    bool earliest = _timers.empty() || at < _timers.top().at;
+    _timers.push(timer{at, ruleIndex, std::move(topic), generation});
+    if(!_timerThread.joinable()){
+        _timerThread = std::thread(&PublishShaper::timerLoop, this);
+    }
+    if(earliest){
+        _timerCondition.notify_all();
+    }
+}
+
+PublishShaper::admission PublishShaper::admit(const pendingPublish& message, std::vector<pendingPublish>& frames){
+    ruleState& state = _rules[message.ruleIndex];
+    auto now = std::chrono::steady_clock::now();
+    if(state.settings.rate > 0){
+        double elapsed = std::chrono::duration<double>(now - state.refilledAt).count();
+        state.tokens = std::min(state.settings.burst, state.tokens + elapsed * state.settings.rate);
+        state.refilledAt = now;
+        if(state.tokens < 1){
+            ++_counters.dropped;
+            return ADMIT_DROPPED;
+        }
+        state.tokens -= 1;
+    }
+    if(state.settings.batchTopic.empty()){
+        return ADMIT_SEND;
+    }
+    if(state.frameMessages == 0){
+        addTimer(now + state.settings.batchWindow, message.ruleIndex, "", state.frameGeneration);
+    }
+    frame(state.frame, message.topic, message.payload);
+    ++state.frameMessages;
+    state.frameQos = std::max(state.frameQos, message.qos);
+    ++_counters.batched;
+    if(state.frameMessages >= state.settings.batchMaxMessages || state.frame.size() >= state.settings.batchMaxBytes){
+        takeFrame(message.ruleIndex, frames);
+    }
+    return ADMIT_HELD;
+}
+
+void PublishShaper::takeFrame(size_t ruleIndex, std::vector<pendingPublish>& frames){
+    ruleState& state = _rules[ruleIndex];
+    pendingPublish framed;
+    framed.topic = state.settings.batchTopic;
+    framed.payload = std::move(state.frame);
+    framed.qos = state.frameQos;
+    framed.ruleIndex = ruleIndex;
+    frames.push_back(std::move(framed));
+    state.frame.clear();
+    state.frameMessages = 0;
+    state.frameQos = 0;
+    ++state.frameGeneration;
+    ++_counters.frames;
+}
+
+void PublishShaper::sendReporting(const pendingPublish& message){
+    // paho refusing it, or the offline log (a message too large for it, a full disk)
+    try {
+        _send(message.topic, message.payload, message.qos, message.retain);
+    } catch (const std::exception& exc) {
+        if(_report){
+            _report(MqttCallbacks::PUBLISH_FAILURE, message.topic, message.payload, message.qos, message.retain);
+        }
+    }
+}
+
+int PublishShaper::publish(const std::string& topic, const std::string& payload, int qos, bool retain){
+    int ruleIndex = ruleOf(topic);
+    if(ruleIndex < 0){
+        return _send(topic, payload, qos, retain);
+    }
+    pendingPublish message{topic, payload, qos, retain, static_cast<size_t>(ruleIndex), 0};
+    std::vector<pendingPublish> frames;
+    admission admitted = ADMIT_HELD;
+    bool coalesced = false;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        const rule& settings = _rules[ruleIndex].settings;
+        if(settings.coalesceWindow.count() > 0){
+            auto pending = _pending.find(topic);
+            if(pending == _pending.end()){
+                message.generation = _nextGeneration++;
+                addTimer(std::chrono::steady_clock::now() + settings.coalesceWindow, message.ruleIndex, topic, message.generation);
+                _pending.emplace(topic, std::move(message));
+                return 0;
+            }
+            // the held message is replaced, message gets it back for the report
+            std::swap(pending->second.payload, message.payload);
+            std::swap(pending->second.qos, message.qos);
+            std::swap(pending->second.retain, message.retain);
+            ++_counters.coalesced;
+            coalesced = true;
+        } else {
+            admitted = admit(message, frames);
+        }
+    }
+    if(coalesced){
+        if(_report){
+            _report(MqttCallbacks::PUBLISH_COALESCED, message.topic, message.payload, message.qos, message.retain);
+        }
+        return 0;
+    }
+    if(admitted == ADMIT_DROPPED && _report){
+        _report(MqttCallbacks::PUBLISH_DROPPED, topic, payload, qos, retain);
+    }
+    // the frames hold earlier publishes, their failures are reported rather than thrown at this caller
+    for(const pendingPublish& framed : frames){
+        sendReporting(framed);
+    }
+    // like an unshaped publish, a refusal of the caller's own message is thrown
+    return admitted == ADMIT_SEND ? _send(topic, payload, qos, retain) : 0;
+}
+
+void PublishShaper::flush(){
+    std::vector<pendingPublish> frames;
+    std::vector<pendingPublish> send;
+    std::vector<pendingPublish> dropped;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for(auto& pending : _pending){
+            switch(admit(pending.second, frames)){
+                case ADMIT_SEND: send.push_back(std::move(pending.second)); break;
+                case ADMIT_DROPPED: dropped.push_back(std::move(pending.second)); break;
+                default: break;
+            }
+        }
+        _pending.clear();
+        for(size_t i = 0; i < _rules.size(); ++i){
+            if(_rules[i].frameMessages > 0){
+                takeFrame(i, frames);
+            }
+        }
+    }
+    for(const pendingPublish& message : dropped){
+        if(_report){
+            _report(MqttCallbacks::PUBLISH_DROPPED, message.topic, message.payload, message.qos, message.retain);
+        }
+    }
+    for(const pendingPublish& message : send){
+        sendReporting(message);
+    }
+    for(const pendingPublish& framed : frames){
+        sendReporting(framed);
+    }
+}
+
+PublishShaper::counters PublishShaper::getCounters(){
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _counters;
+}
+
+void PublishShaper::timerLoop(){
+    std::unique_lock<std::mutex> lock(_mutex);
+    while(!_stop){
+        if(_timers.empty()){
+            _timerCondition.wait(lock);
+            continue;
+        }
+        // copied, the heap may reallocate while waiting
+        std::chrono::steady_clock::time_point at = _timers.top().at;
+        if(std::chrono::steady_clock::now() < at){
+            // woken early when an earlier timer is added
+            _timerCondition.wait_until(lock, at);
+            continue;
+        }
+        timer due = _timers.top();
+        _timers.pop();
+
+        std::vector<pendingPublish> frames;
+        pendingPublish message;
+        admission admitted = ADMIT_HELD;
+        if(due.topic.empty()){
+            ruleState& state = _rules[due.ruleIndex];
+            if(state.frameGeneration == due.generation && state.frameMessages > 0){
+                takeFrame(due.ruleIndex, frames);
+            }
+        } else {
+            auto pending = _pending.find(due.topic);
+            if(pending != _pending.end() && pending->second.generation == due.generation){
+                message = std::move(pending->second);
+                _pending.erase(pending);
+                admitted = admit(message, frames);
+            }
+        }
+        lock.unlock();
+        if(admitted == ADMIT_DROPPED && _report){
+            _report(MqttCallbacks::PUBLISH_DROPPED, message.topic, message.payload, message.qos, message.retain);
+        }
+        if(admitted == ADMIT_SEND){
+            sendReporting(message);
+        }
+        for(const pendingPublish& framed : frames){
+            sendReporting(framed);
+        }
+        lock.lock();
+    }
+}
+
+void PublishShaper::frame(std::string& out, std::string_view topic, std::string_view payload){
+    out += static_cast<char>((topic.size() >> 8) & 0xff);
+    out += static_cast<char>(topic.size() & 0xff);
+    out.append(topic);
+    for(int shift = 24; shift >= 0; shift -= 8){
+        out += static_cast<char>((payload.size() >> shift) & 0xff);
+    }
+    out.append(payload);
+}
+
+bool PublishShaper::unframe(std::string_view frame, const std::function<void(std::string_view topic, std::string_view payload)>& entry){
+    size_t pos = 0;
+    auto length = [&](size_t bytes, size_t& value){
+        if(frame.size() - pos < bytes){
+            return false;
+        }
+        value = 0;
+        for(size_t i = 0; i < bytes; ++i){
+            value = (value << 8) | static_cast<uint8_t>(frame[pos++]);
+        }
+        return true;
+    };
+    while(pos < frame.size()){
+        size_t topicLength;
+        if(!length(2, topicLength) || frame.size() - pos < topicLength){
+            return false;
+        }
+        std::string_view topic = frame.substr(pos, topicLength);
+        pos += topicLength;
+        size_t payloadLength;
+        if(!length(4, payloadLength) || frame.size() - pos < payloadLength){
+            return false;
+        }
+        entry(topic, frame.substr(pos, payloadLength));
+        pos += payloadLength;
+    }
+    return true;
+}
@@ -0,0 +1,142 @@
+#include "RequestTracker.hpp"
+
+#include <algorithm>
+
+static std::string encodeCorrelationId(uint64_t id){
+    std::string correlationData(sizeof(id), '\0');
+    for(size_t i = 0; i < sizeof(id); ++i){
+        correlationData[i] = static_cast<char>((id >> (8 * i)) & 0xff);
+    }
+    return correlationData;
+}
+
+static bool decodeCorrelationId(const std::string& correlationData, uint64_t& id){
+    if(correlationData.size() != sizeof(id)){
+        return false;
+    }
+    id = 0;
+    for(size_t i = 0; i < sizeof(id); ++i){
+        id |= static_cast<uint64_t>(static_cast<unsigned char>(correlationData[i])) << (8 * i);
+    }
+    return true;
+}
+
+RequestTracker::RequestTracker(std::chrono::milliseconds tickPeriod, size_t wheelSlots)
+    : _tickPeriod(tickPeriod), _wheel(wheelSlots) {
+}
+
+RequestTracker::~RequestTracker(){
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _stopCondition.notify_all();
+    if(_timerThread.joinable()){
+        _timerThread.join();
+    }
+}
+
+std::future<mqtt::const_message_ptr> RequestTracker::add(std::chrono::milliseconds timeout, std::string& correlationData){
+    // round up so a request never expires early
+    uint64_t ticks = (timeout.count() + _tickPeriod.count() - 1) / _tickPeriod.count();
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(!_timerThread.joinable()){
+        _timerThread = std::thread(&RequestTracker::timerLoop, this);
+    }
+    uint64_t id = _nextId++;
+    uint64_t expiryTick = _currentTick + std::max<uint64_t>(ticks, 1);
+    pendingRequest& request = _pending[id];
+    request.expiryTick = expiryTick;
+    _wheel[expiryTick % _wheel.size()].push_back(id);
+    correlationData = encodeCorrelationId(id);
+    return request.promise.get_future();
+}
+
+bool RequestTracker::complete(mqtt::const_message_ptr msg){
+    const mqtt::properties& msgProps = msg->get_properties();
+    if(!msgProps.contains(mqtt::property::code::CORRELATION_DATA)){
+        return false;
+    }
+    uint64_t id;
+    if(!decodeCorrelationId(mqtt::get<mqtt::binary>(msgProps, mqtt::property::code::CORRELATION_DATA), id)){
+        return false;
+    }
+    std::promise<mqtt::const_message_ptr> promise;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto request = _pending.find(id);
+        if(request == _pending.end()){
+            return false;
+        }
+        promise = std::move(request->second.promise);
+        _pending.erase(request);
+    }
+    promise.set_value(std::move(msg));
+    return true;
+}
+
+void RequestTracker::fail(const std::string& correlationData, std::exception_ptr error){
+    uint64_t id;
+    if(!decodeCorrelationId(correlationData, id)){
+        return;
+    }
+    std::promise<mqtt::const_message_ptr> promise;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        auto request = _pending.find(id);
+        if(request == _pending.end()){
+            return;
+        }
+        promise = std::move(request->second.promise);
+        _pending.erase(request);
+    }
+    promise.set_exception(error);
+}
+
+size_t RequestTracker::pending(){
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _pending.size();
+}
+
+void RequestTracker::expire(uint64_t tick){
+    std::vector<std::promise<mqtt::const_message_ptr>> expired;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _currentTick = tick;
+        std::vector<uint64_t>& slot = _wheel[tick % _wheel.size()];
+        size_t kept = 0;
+        for(uint64_t id : slot){
+            auto request = _pending.find(id);
+            if(request == _pending.end()){
+                continue;
+            }
+            if(request->second.expiryTick <= tick){
+                expired.push_back(std::move(request->second.promise));
+                _pending.erase(request);
+            } else {
+                // expires on a later turn of the wheel
+                slot[kept++] = id;
+            }
+        }
+        slot.resize(kept);
+    }
+    for(auto& promise : expired){
+        promise.set_exception(std::make_exception_ptr(RequestTimeout()));
+    }
+}
+
+void RequestTracker::timerLoop(){
+    auto nextTick = std::chrono::steady_clock::now() + _tickPeriod;
+    uint64_t tick = 0;
+    while(true){
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if(_stopCondition.wait_until(lock, nextTick, [this] { return _stop; })){
+                return;
+            }
+            tick = _currentTick + 1;
+        }
+        expire(tick);
+        nextTick += _tickPeriod;
+    }
+}
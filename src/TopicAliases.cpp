@@ -0,0 +1,119 @@
+#include "TopicAliases.hpp"
+
+#include <algorithm>
+
+// the Topic Alias property: identifier byte and two byte value
+static constexpr int64_t aliasPropertyBytes = 3;
+
+void TopicAliases::configure(settings aliasSettings){
+    _settings = aliasSettings;
+}
+
+const TopicAliases::settings& TopicAliases::getSettings() const {
+    return _settings;
+}
+
+void TopicAliases::connected(uint16_t brokerMaximum){
+    uint16_t maximum = brokerMaximum;
+    if(_settings.maxOutbound != 0){
+        maximum = std::min(maximum, _settings.maxOutbound);
+    }
+    resetOutbound(maximum);
+    // only called from the paho callback thread, before the first message of the connection
+    _inbound.assign(_settings.maxInbound + 1, mqtt::string_ref());
+}
+
+void TopicAliases::stopOutbound(){
+    resetOutbound(0);
+}
+
+void TopicAliases::resetOutbound(uint16_t maximum){
+    std::lock_guard<std::mutex> lock(_outboundMutex);
+    _recent.clear();
+    _outbound.clear();
+    _nextAlias = 1;
+    _freeAliases.clear();
+    _maxOutbound.store(maximum, std::memory_order_relaxed);
+}
+
+std::unique_lock<std::mutex> TopicAliases::outboundLock(){
+    return std::unique_lock<std::mutex>(_outboundMutex);
+}
+
+uint16_t TopicAliases::assign(const std::string& topic, int qos, bool& known){
+    known = false;
+    uint16_t maximum = _maxOutbound.load(std::memory_order_relaxed);
+    if(maximum == 0 || (_settings.qos0Only && qos != 0) || topic.empty()){
+        return 0;
+    }
+    auto found = _outbound.find(topic);
+    if(found != _outbound.end()){
+        _recent.splice(_recent.begin(), _recent, found->second);
+        known = true;
+        _hits.fetch_add(1, std::memory_order_relaxed);
+        _bytesSaved.fetch_add(static_cast<int64_t>(topic.size()) - aliasPropertyBytes, std::memory_order_relaxed);
+        return found->second->second;
+    }
+    uint16_t alias;
+    if(!_freeAliases.empty()){
+        alias = _freeAliases.back();
+        _freeAliases.pop_back();
+    } else if(_nextAlias <= maximum){
+        alias = _nextAlias++;
+    } else {
+        alias = _recent.back().second;
+        _outbound.erase(_recent.back().first);
+        _recent.pop_back();
+        _evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+    _recent.emplace_front(topic, alias);
+    _outbound.emplace(topic, _recent.begin());
+    _misses.fetch_add(1, std::memory_order_relaxed);
+    _bytesSaved.fetch_sub(aliasPropertyBytes, std::memory_order_relaxed);
+    return alias;
+}
+
+void TopicAliases::forget(const std::string& topic){
+    auto found = _outbound.find(topic);
+    if(found == _outbound.end()){
+        return;
+    }
+    _freeAliases.push_back(found->second->second);
+    _recent.erase(found->second);
+    _outbound.erase(found);
+}
+
+mqtt::const_message_ptr TopicAliases::resolve(mqtt::const_message_ptr msg){
+    const mqtt::properties& props = msg->get_properties();
+    if(!props.contains(mqtt::property::code::TOPIC_ALIAS)){
+        return msg;
+    }
+    size_t alias = static_cast<size_t>(mqtt::get<uint16_t>(props, mqtt::property::code::TOPIC_ALIAS));
+    if(alias == 0 || alias >= _inbound.size()){
+        return msg;
+    }
+    if(!msg->get_topic().empty()){
+        _inbound[alias] = msg->get_topic_ref();
+        _inboundRegistered.fetch_add(1, std::memory_order_relaxed);
+        return msg;
+    }
+    if(!_inbound[alias]){
+        _inboundUnknown.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    _inboundResolved.fetch_add(1, std::memory_order_relaxed);
+    // shares the payload buffer, only the message object is new
+    return mqtt::message::create(_inbound[alias], msg->get_payload_ref(), msg->get_qos(), msg->is_retained(), props);
+}
+
+TopicAliases::counters TopicAliases::getCounters() const {
+    counters current;
+    current.hits = _hits.load(std::memory_order_relaxed);
+    current.misses = _misses.load(std::memory_order_relaxed);
+    current.evictions = _evictions.load(std::memory_order_relaxed);
+    current.bytesSaved = _bytesSaved.load(std::memory_order_relaxed);
+    current.inboundRegistered = _inboundRegistered.load(std::memory_order_relaxed);
+    current.inboundResolved = _inboundResolved.load(std::memory_order_relaxed);
+    current.inboundUnknown = _inboundUnknown.load(std::memory_order_relaxed);
+    return current;
+}
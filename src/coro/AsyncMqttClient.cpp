@@ -0,0 +1,92 @@
+#include "coro/AsyncMqttClient.hpp"
+
+#include <stdexcept>
+
+AsyncMqttClient::actionAwaiter::actionAwaiter(MqttClient& client, CoroExecutor& executor)
+    : _executor(executor), _client(client) {
+}
+
+void AsyncMqttClient::actionAwaiter::await_suspend(std::coroutine_handle<> awaiting){
+    _awaiting = awaiting;
+    // the listener may resume the coroutine, and destroy this, before submit returns.
+    // If paho refuses the operation it throws here instead and the coroutine resumes
+    // with that exception
+    submit();
+}
+
+void AsyncMqttClient::actionAwaiter::rethrowFailure() const {
+    if(_exception){
+        std::rethrow_exception(_exception);
+    }
+}
+
+void AsyncMqttClient::actionAwaiter::await_resume() const {
+    rethrowFailure();
+}
+
+void AsyncMqttClient::actionAwaiter::on_failure(const mqtt::token& tok){
+    _exception = std::make_exception_ptr(mqtt::exception(tok.get_return_code()));
+    _executor.post(_awaiting);
+}
+
+void AsyncMqttClient::actionAwaiter::on_success(const mqtt::token& tok){
+    _messageId = tok.get_message_id();
+    _executor.post(_awaiting);
+}
+
+void AsyncMqttClient::connectAwaiter::submit(){
+    _client.start(*this);
+}
+
+AsyncMqttClient::publishAwaiter::publishAwaiter(MqttClient& client, CoroExecutor& executor, const std::string& topic, const std::string& payload, int qos, bool retain)
+    : actionAwaiter(client, executor), _topic(topic), _payload(payload), _qos(qos), _retain(retain) {
+}
+
+void AsyncMqttClient::publishAwaiter::submit(){
+    _client.publish(_topic, _payload, _qos, _retain, *this);
+}
+
+int AsyncMqttClient::publishAwaiter::await_resume() const {
+    rethrowFailure();
+    return _messageId;
+}
+
+AsyncMqttClient::subscribeAwaiter::subscribeAwaiter(MqttClient& client, CoroExecutor& executor, const std::string& topicFilter, int qos)
+    : actionAwaiter(client, executor), _topicFilter(topicFilter), _qos(qos) {
+}
+
+void AsyncMqttClient::subscribeAwaiter::submit(){
+    _client.subscribe(_topicFilter, _qos, *this);
+}
+
+AsyncMqttClient::AsyncMqttClient(MqttClient& client, CoroExecutor& executor)
+    : _client(client), _executor(executor) {
+}
+
+AsyncMqttClient::connectAwaiter AsyncMqttClient::connect(){
+    return connectAwaiter(_client, _executor);
+}
+
+AsyncMqttClient::publishAwaiter AsyncMqttClient::publish(const std::string& topic, const std::string& payload, int qos, bool retain){
+    return publishAwaiter(_client, _executor, topic, payload, qos, retain);
+}
+
+AsyncMqttClient::subscribeAwaiter AsyncMqttClient::subscribe(const std::string& topicFilter, int qos){
+    return subscribeAwaiter(_client, _executor, topicFilter, qos);
+}
+
+std::shared_ptr<MessageStream> AsyncMqttClient::stream(const std::string& topicFilter, size_t capacity){
+    // on would keep the existing handler, and the stream would never yield
+    if(_client.hasHandler(topicFilter)){
+        throw std::invalid_argument("Topic filter already has a handler: " + topicFilter);
+    }
+    auto stream = std::make_shared<MessageStream>(_executor, capacity);
+    _client.on(topicFilter, [stream](std::string_view topic, std::string_view payload, std::string& response){
+        stream->push(topic, payload);
+    });
+    return stream;
+}
+
+CoroExecutor& AsyncMqttClient::executor(){
+    return _executor;
+}
@@ -0,0 +1,68 @@
+#include "coro/CoroExecutor.hpp"
+
+CoroExecutor::CoroExecutor(int numThreads, size_t queueCapacity)
+    : _ready(queueCapacity) {
+    for(int i = 0; i < numThreads; ++i){
+        _threads.emplace_back(&CoroExecutor::threadLoop, this);
+    }
+}
+
+CoroExecutor::~CoroExecutor(){
+    _stopExecution = true;
+    _notEmpty.notifyAll();
+    for(auto& thread : _threads){
+        thread.join();
+    }
+}
+
+void CoroExecutor::post(std::coroutine_handle<> handle){
+    if(!_ready.tryPush(std::move(handle))){
+        std::lock_guard<std::mutex> lock(_overflowMutex);
+        _overflow.push_back(handle);
+        _overflowSize.fetch_add(1, std::memory_order_release);
+    }
+    _notEmpty.notifyOne();
+}
+
+CoroExecutor::scheduleAwaiter CoroExecutor::schedule(){
+    return scheduleAwaiter(*this);
+}
+
+bool CoroExecutor::tryTake(std::coroutine_handle<>& handle){
+    if(_ready.tryPop(handle)){
+        return true;
+    }
+    if(_overflowSize.load(std::memory_order_acquire) == 0){
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(_overflowMutex);
+    if(_overflow.empty()){
+        return false;
+    }
+    handle = _overflow.front();
+    _overflow.pop_front();
+    _overflowSize.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+void CoroExecutor::threadLoop(){
+    std::coroutine_handle<> handle;
+    while(true){
+        if(tryTake(handle)){
+            handle.resume();
+            continue;
+        }
+        uint64_t epoch = _notEmpty.prepareWait();
+        if(tryTake(handle)){
+            _notEmpty.cancelWait();
+            handle.resume();
+            continue;
+        }
+        // drain what was posted before stopping
+        if(_stopExecution){
+            _notEmpty.cancelWait();
+            return;
+        }
+        _notEmpty.commitWait(epoch);
+    }
+}
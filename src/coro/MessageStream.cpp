@@ -0,0 +1,67 @@
+#include "coro/MessageStream.hpp"
+
+#include <utility>
+
+MessageStream::MessageStream(CoroExecutor& executor, size_t capacity)
+    : _executor(executor), _capacity(capacity) {
+}
+
+bool MessageStream::nextAwaiter::await_suspend(std::coroutine_handle<> awaiting){
+    std::lock_guard<std::mutex> lock(_stream._mutex);
+    // a message (or the close) may have arrived since the caller last looked
+    if(!_stream._buffered.empty() || _stream._closed){
+        return false;
+    }
+    _stream._waiting = awaiting;
+    return true;
+}
+
+std::optional<MessageStream::message> MessageStream::nextAwaiter::await_resume(){
+    std::lock_guard<std::mutex> lock(_stream._mutex);
+    if(_stream._buffered.empty()){
+        return std::nullopt;
+    }
+    message next = std::move(_stream._buffered.front());
+    _stream._buffered.pop_front();
+    return next;
+}
+
+void MessageStream::push(std::string_view topic, std::string_view payload){
+    std::coroutine_handle<> waiting;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if(_closed){
+            return;
+        }
+        if(_buffered.size() >= _capacity){
+            _buffered.pop_front();
+            ++_dropped;
+        }
+        _buffered.push_back(message{std::string(topic), std::string(payload)});
+        waiting = std::exchange(_waiting, nullptr);
+    }
+    if(waiting){
+        _executor.post(waiting);
+    }
+}
+
+MessageStream::nextAwaiter MessageStream::next(){
+    return nextAwaiter(*this);
+}
+
+void MessageStream::close(){
+    std::coroutine_handle<> waiting;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+        waiting = std::exchange(_waiting, nullptr);
+    }
+    if(waiting){
+        _executor.post(waiting);
+    }
+}
+
+uint64_t MessageStream::dropped(){
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _dropped;
+}